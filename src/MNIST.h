@@ -33,22 +33,174 @@
 #ifndef MNIST_h
 #define MNIST_h
 
+#include <algorithm>
+#include <climits>
+
 #include "Settings.h"
+#include "MappedFile.h"
+#include "NeuralNetVec/NetSimd.h"
+
+
+#define MNIST_CLASSES               10                          // Digits 0-9 (length of the one-hot output)
 
 
+// One digit of an MNISTset: Only points to the raw pixels, the net input (0.0-1.0)
+// and the expected output are written straight into the callers buffers
 struct MNISTchar {
-    std::vector<double> pixelData;          // Store the 784 (28x28) pixel color values (0-255) of the digit-image
-    std::vector<double> output;             // Store the expected output (e.g: label 5 / output 0,0,0,0,0,1,0,0,0,0)
+    ByteSpan pixelData;                     // The 784 (28x28) pixel color values (0-255) of the digit-image
     int label;                              // Store the handwritten digit in number form
-    MNISTchar() : pixelData(std::vector<double>()), output(std::vector<double>(10)), label(0) {}
+    MNISTchar(ByteSpan pixels, int l) : pixelData(pixels), label(l) {}
+    
+    // Normalized pixels (0.0-1.0): out (float or double) has to hold pixelData.size values
+    template<typename T>
+    inline void normalizedPixels(T* out) const { Simd<T>().ConvertBytes(pixelData.data, (T)(1.0 / 255), out, pixelData.size); }
+    // Expected output (e.g: label 5 / output 0,0,0,0,0,1,0,0,0,0): out has to hold MNIST_CLASSES values
+    template<typename T>
+    inline void expectedOutput(T* out) const {
+        std::fill(out, out + MNIST_CLASSES, (T)0);
+        out[label] = 1;
+    }
+};
+
+
+
+// Contiguous set of digits: The raw 8-Bit pixels and labels, laid out as in the IDX files
+// (1 Byte per pixel instead of a double, no one-hot vector per digit). The set owns a copy of
+// the bytes: the IDX files are only mapped to load them in one bulk copy (see MNIST)
+class MNISTset {
+private:
+    ulong _imageSize;
+    std::vector<byte> _pixels;              // count x imageSize
+    std::vector<byte> _labels;
+    ulong _nonZero;                         // Nonzero pixels (counted whenever digits are added, see density)
+
+public:
+    MNISTset(ulong imageSize = 0) : _imageSize(imageSize), _nonZero(0) {}
+
+    // Append a digit (e.g. to build augmented sets in memory)
+    void add(const byte* pixels, byte label) {
+        _pixels.insert(_pixels.end(), pixels, pixels + _imageSize);
+        _labels.push_back(label);
+        _nonZero += CountNonZero(pixels, _imageSize);
+    }
+
+    // Replace the set with "count" digits (one bulk copy, e.g. out of a mapped IDX file)
+    void assign(const byte* pixels, const byte* labels, ulong count) {
+        _pixels.assign(pixels, pixels + (count * _imageSize));
+        _labels.assign(labels, labels + count);
+        _nonZero = CountNonZero(_pixels.data(), _pixels.size());
+    }
+
+    void reserve(ulong count) {
+        _pixels.reserve(count * _imageSize);
+        _labels.reserve(count);
+    }
+
+    // Copy of "count" digits from "first" on (e.g. to hold out a validation set)
+    MNISTset slice(ulong first, ulong count) const {
+        MNISTset set(_imageSize);
+        first = std::min(first, size());
+        count = std::min(count, size() - first);
+        set._pixels.assign(_pixels.begin() + first * _imageSize, _pixels.begin() + (first + count) * _imageSize);
+        set._labels.assign(_labels.begin() + first, _labels.begin() + first + count);
+        set._nonZero = CountNonZero(set._pixels.data(), set._pixels.size());
+        return set;
+    }
+
+
+    // GETTER
+    inline ulong size() const { return _labels.size(); }
+    inline ulong imageSize() const { return _imageSize; }
+    // Share of nonzero pixels (MNIST: ~0.2, see the sparse input layer in NetMath.h), kept up to date by add / assign
+    inline double density() const { return _pixels.empty() ? 0 : (double)_nonZero / _pixels.size(); }
+    inline MNISTchar operator[](ulong i) const { return MNISTchar(ByteSpan(_pixels.data() + (i * _imageSize), _imageSize), _labels[i]); }
+
+    // Range based for loops over the digits
+    struct const_iterator {
+        const MNISTset* set;
+        ulong index;
+        inline MNISTchar operator*() const { return (*set)[index]; }
+        inline const_iterator& operator++() { ++index; return *this; }
+        inline bool operator!=(const const_iterator& other) const { return index != other.index; }
+    };
+    inline const_iterator begin() const { return const_iterator{this, 0}; }
+    inline const_iterator end() const { return const_iterator{this, size()}; }
+
+private:
+    static ulong CountNonZero(const byte* pixels, ulong count) { return count - std::count(pixels, pixels + count, 0); }
+
+};
+
+
+
+// Memory mapped IDX file (the MNIST file format): The header is validated once,
+// the items are exposed as spans straight into the mapped file (nothing is copied)
+//   magic number:  0x00 0x00 [data type, 0x08 = unsigned byte] [number of dimensions]
+//   dimensions:    one big endian 4 Byte integer per dimension (the first one is the item count)
+//   data:          count x (product of the other dimensions) bytes
+class IDXFile {
+private:
+    MappedFile _file;
+    ulong _count;                           // Number of items (images / labels)
+    ulong _itemSize;                        // Bytes per item (e.g. 28x28 for an image, 1 for a label)
+    ulong _dataOffset;                      // Header size
+
+public:
+    IDXFile(const std::string& path, const ulong dimensions) : _file(path), _count(0), _itemSize(0), _dataOffset(0) {
+        if (!_file.isOpen()) {
+            std::cout <<"ERROR: opening " <<path <<std::endl;
+            return;
+        }
+        const byte* header = _file.data();
+        _dataOffset = 4 + (4 * dimensions);
+        if (_file.size() < _dataOffset || header[0] != 0 || header[1] != 0 || header[2] != 0x08 || header[3] != dimensions) {
+            std::cout <<"ERROR: " <<path <<" is not an IDX file with " <<dimensions <<" dimension(s) of unsigned bytes" <<std::endl;
+            _file.Close();
+            return;
+        }
+        const ulong count = ReadBigEndian(header + 4);
+        // (Checked products, a forged header must not wrap the sizes past the file size)
+        ulong itemSize = 1;
+        for (ulong d = 1; d < dimensions; d++) {
+            const ulong dimension = ReadBigEndian(header + 4 + (4 * d));
+            if (dimension == 0 || itemSize > ULONG_MAX / dimension) {
+                std::cout <<"ERROR: " <<path <<" has an empty or oversized item dimension" <<std::endl;
+                _file.Close();
+                return;
+            }
+            itemSize *= dimension;
+        }
+        if (count > (_file.size() - _dataOffset) / itemSize) {
+            std::cout <<"ERROR: " <<path <<" is truncated (" <<count <<" items announced)" <<std::endl;
+            _file.Close();
+            return;
+        }
+        _count = count;
+        _itemSize = itemSize;
+    }
+
+
+    // GETTER
+    inline ulong count() const { return _count; }
+    inline ulong itemSize() const { return _itemSize; }
+    inline ByteSpan items() const { return _file.span(_dataOffset, _count * _itemSize); }
+    inline ByteSpan item(ulong i) const { return _file.span(_dataOffset + (i * _itemSize), _itemSize); }
+    // Dimension d of the header (e.g. 1 = rows and 2 = columns of an image file)
+    inline ulong dimension(ulong d) const { return _count ? ReadBigEndian(_file.data() + 4 + (4 * d)) : 0; }
+
+private:
+    static inline ulong ReadBigEndian(const byte* p) {
+        return ((ulong)p[0] << 24) | ((ulong)p[1] << 16) | ((ulong)p[2] << 8) | (ulong)p[3];
+    }
+
 };
 
 
 
 class MNIST {
 public:
-    const std::vector<MNISTchar> trainingData;  // Set of 60.000 handwritten digits to train the net
-    const std::vector<MNISTchar> testData;      // Set of 10.000 different handwritten digits to test the net
+    const MNISTset trainingData;                // Set of 60.000 handwritten digits to train the net
+    const MNISTset testData;                    // Set of 10.000 different handwritten digits to test the net
     
     
     MNIST(const std::string& path)
@@ -60,53 +212,23 @@ public:
     
     
 private:
-    std::vector<MNISTchar> getMNISTdata(const std::string& imagepath, const std::string& labelpath) {
-        std::vector<MNISTchar> tmpdata = std::vector<MNISTchar>();
-        std::fstream file (imagepath, std::ifstream::in | std::ifstream::binary);
-        int magicNum_images = 0, magicNum_labels = 0;
-        int itemCount_images = 0, itemCount_labels = 0;
-        // READ THE IMAGE FILE DATA
-        if(file.is_open()) {
-            int row_count = 0, col_count = 0;
-            // FILE HEADER INFO is stored as 4 Byte Integers
-            file.read((char*)&magicNum_images, 4);
-            file.read((char*)&itemCount_images, 4);
-            file.read((char*)&row_count, 4);
-            file.read((char*)&col_count, 4);
-            // Transform Byte values from big to little endian
-            magicNum_images = swap32(magicNum_images);
-            itemCount_images = swap32(itemCount_images);
-            row_count = swap32(row_count);
-            col_count= swap32(col_count);
-            // Loop throug all the items and store every pixel of every row
-            for (int i = 0; i < itemCount_images; i++) {
-                MNISTchar tmpchar = MNISTchar();
-                for(int r = 0; r < (row_count * col_count); r++) {
-                    byte pixel = 0;
-                    // read one byte (0-255 color value of the pixel)
-                    file.read((char*)&pixel, 1);
-                    tmpchar.pixelData.push_back((double)pixel / 255);
-                }
-                tmpdata.push_back(tmpchar);
-            }
+    MNISTset getMNISTdata(const std::string& imagepath, const std::string& labelpath) {
+        const IDXFile images(imagepath, 3);
+        const IDXFile labels(labelpath, 1);
+        MNISTset tmpdata(images.itemSize());
+        if(images.count() != labels.count()) {
+            std::cout <<"ERROR: " <<images.count() <<" images but " <<labels.count() <<" labels" <<std::endl;
+            return tmpdata;
         }
-        file.close();
-        // READ THE LABEL FILE DATA
-        file.open(labelpath, std::ifstream::in | std::ifstream::binary);
-        if (file.is_open()) {
-            file.read((char*)&magicNum_labels, 4);
-            file.read((char*)&itemCount_labels, 4);
-            magicNum_labels = swap32(magicNum_labels);
-            itemCount_labels = swap32(itemCount_labels);
-            if(itemCount_images == itemCount_labels) {
-                // read all the labels and store them in theire MNISTchars
-                for(MNISTchar& m : tmpdata) {
-                    file.read((char*)&m.label, 1);
-                    m.output[m.label] = 1.0f;
-                }
+        const ByteSpan labelData = labels.items();
+        for(const byte& l : labelData) {
+            if(l >= MNIST_CLASSES) {
+                std::cout <<"ERROR: " <<labelpath <<" holds the label " <<(int)l <<std::endl;
+                return tmpdata;
             }
         }
-        file.close();
+        // The mapping is only a bulk loader: the set copies the raw bytes at once (the files are unmapped again when this returns)
+        tmpdata.assign(images.items().data, labelData.data, images.count());
         return tmpdata;
     }
     
@@ -118,12 +240,12 @@ public:
         std::vector<std::string> tmpStrings = std::vector<std::string>();
         int count = 0;
         std::string line = "";
-        for (const double& r : mchar.pixelData) {
+        for (const byte& r : mchar.pixelData) {
             if(count < 27) {
-                if(r < 0.25) line += " ";
-                else if(r < 0.5) line += "-";
-                else if(r < 0.75) line += "+";
-                else if(r <= 1.0) line += "#";
+                if(r < 64) line += " ";
+                else if(r < 128) line += "-";
+                else if(r < 192) line += "+";
+                else line += "#";
                 ++count;
             } else {
                 tmpStrings.push_back(line);
@@ -0,0 +1,164 @@
+//  MappedFile.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include "Settings.h"
+
+#if WINDOWS
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+
+// Read only view of a byte range (the bytes are owned by someone else, e.g. a MappedFile)
+struct ByteSpan {
+    const byte* data;
+    ulong size;
+
+    ByteSpan() : data(nullptr), size(0) { }
+    ByteSpan(const byte* d, ulong s) : data(d), size(s) { }
+
+    inline const byte* begin() const { return data; }
+    inline const byte* end() const { return data + size; }
+    inline const byte& operator[](ulong i) const { return data[i]; }
+};
+
+
+// Read only memory mapping of a whole file: The OS pages the file in on demand,
+// nothing is copied or parsed until it is accessed
+class MappedFile {
+private:
+    const byte* _data;
+    ulong _size;
+#if WINDOWS
+    HANDLE _file, _mapping;
+#else
+    int _file;
+#endif
+
+public:
+    MappedFile() : _data(nullptr), _size(0) { ResetHandles(); }
+
+    MappedFile(const std::string& path) : _data(nullptr), _size(0) {
+        ResetHandles();
+        Open(path);
+    }
+
+    ~MappedFile() { Close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) : _data(other._data), _size(other._size) {
+#if WINDOWS
+        _file = other._file;
+        _mapping = other._mapping;
+#else
+        _file = other._file;
+#endif
+        other._data = nullptr;
+        other._size = 0;
+        other.ResetHandles();
+    }
+
+
+    // Map the file, returns false (and stays empty) if it can not be opened or mapped
+    bool Open(const std::string& path) {
+        Close();
+#if WINDOWS
+        _file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (_file == INVALID_HANDLE_VALUE) { return false; }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(_file, &fileSize) || fileSize.QuadPart == 0) { Close(); return false; }
+        _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (_mapping == nullptr) { Close(); return false; }
+        _data = (const byte*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (_data == nullptr) { Close(); return false; }
+        _size = (ulong)fileSize.QuadPart;
+#else
+        _file = open(path.c_str(), O_RDONLY);
+        if (_file < 0) { return false; }
+        struct stat info;
+        if (fstat(_file, &info) != 0 || info.st_size == 0) { Close(); return false; }
+        void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, _file, 0);
+        if (mapping == MAP_FAILED) { Close(); return false; }
+        // The training data is read front to back
+        madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+        _data = (const byte*)mapping;
+        _size = info.st_size;
+#endif
+        return true;
+    }
+
+
+    void Close() {
+#if WINDOWS
+        if (_data != nullptr) { UnmapViewOfFile(_data); }
+        if (_mapping != nullptr) { CloseHandle(_mapping); }
+        if (_file != INVALID_HANDLE_VALUE) { CloseHandle(_file); }
+#else
+        if (_data != nullptr) { munmap((void*)_data, _size); }
+        if (_file >= 0) { close(_file); }
+#endif
+        _data = nullptr;
+        _size = 0;
+        ResetHandles();
+    }
+
+
+    // GETTER
+    inline bool isOpen() const { return _data != nullptr; }
+    inline const byte* data() const { return _data; }
+    inline ulong size() const { return _size; }
+    inline ByteSpan span(ulong offset, ulong length) const { return ByteSpan(_data + offset, length); }
+
+private:
+    inline void ResetHandles() {
+#if WINDOWS
+        _file = INVALID_HANDLE_VALUE;
+        _mapping = nullptr;
+#else
+        _file = -1;
+#endif
+    }
+
+};
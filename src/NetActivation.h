@@ -0,0 +1,143 @@
+//  NetActivation.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+
+#include "NetBase.h"
+#include "NeuralNetVec/NetSimd.h"
+
+// Activation functions of both nets (Layer.h of the OOP net, NetMath.h of the VEC net)
+//   Sigmoid:    f(x) = 1 / (1 + e^-x)                      f'(x) = y * (1 - y)
+//   Tanh:       f(x) = tanh(x)                             f'(x) = 1 - y^2
+//   ReLU:       f(x) = max(0, x)                           f'(x) = (y > 0) ? 1 : 0
+//   LeakyReLU:  f(x) = max(LEAKY_RELU_SLOPE * x, x)        f'(x) = (y > 0) ? 1 : LEAKY_RELU_SLOPE
+//   Softmax:    f(x)_i = e^x_i / sum(e^x_j)                df_i/dx_j = y_i * (kronecker_ij - y_j)
+// The derivatives only need the outputs y = f(x) of the forward pass, so the backward pass has no exp / pow.
+// Softmax works on all the neurons of a sample, it is only meant for the output layer.
+// ReLU / leaky ReLU always run on the SIMD kernels. The exp based functions are only vectorised with
+// ACTIVATION_FAST_EXP: the SIMD kernels with the polynomial exp (FastExp in NetSimd.h), relative exp error
+// < 7.5e-9, absolute sigmoid / tanh error < 2e-9 / 4e-9 (double), for float the error stays at the float
+// rounding (about 1e-7). Without it they stay scalar libm loops (one exp / tanh call per value), which keeps
+// the reference results of every build and platform
+
+enum class Activation : uint8_t { Sigmoid = 0, Tanh = 1, ReLU = 2, LeakyReLU = 3, Softmax = 4 };
+
+inline const char* ActivationName(Activation activation) {
+    switch (activation) {
+        case Activation::Sigmoid:   return "Sigmoid";
+        case Activation::Tanh:      return "Tanh";
+        case Activation::ReLU:      return "ReLU";
+        case Activation::LeakyReLU: return "LeakyReLU";
+        case Activation::Softmax:   return "Softmax";
+    }
+    return "Unknown";
+}
+
+
+// f'(x) of one neuron from its output y = f(x) (Softmax: the diagonal of the Jacobian)
+template<typename T>
+inline T ActivationPrime(Activation activation, T y) {
+    switch (activation) {
+        case Activation::Tanh:      return 1 - y * y;
+        case Activation::ReLU:      return (y > 0) ? 1 : 0;
+        case Activation::LeakyReLU: return (y > 0) ? 1 : (T)LEAKY_RELU_SLOPE;
+        default:                    return y * (1 - y);
+    }
+}
+
+
+// Softmax of one sample in place (shifted by the maximum, so e^x can not overflow)
+template<typename T>
+void Softmax(T* values, long width) {
+    const T maximum = *std::max_element(values, values + width);
+    for (long i = 0; i < width; i++) { values[i] -= maximum; }
+    if (ACTIVATION_FAST_EXP) {
+        Simd<T>().Exp(values, width);
+    } else {
+        for (long i = 0; i < width; i++) { values[i] = exp(values[i]); }
+    }
+    T sum = 0;
+    for (long i = 0; i < width; i++) { sum += values[i]; }
+    for (long i = 0; i < width; i++) { values[i] /= sum; }
+}
+
+
+// y = f(x) in place for "count" samples of "width" neurons (back to back)
+template<typename T>
+void Activate(Activation activation, T* values, long width, long count) {
+    const long n = width * count;
+    switch (activation) {
+        case Activation::Sigmoid:
+            if (ACTIVATION_FAST_EXP) { Simd<T>().Sigmoid(values, n); break; }
+            for (long i = 0; i < n; i++) { values[i] = 1 / (1 + exp(-values[i])); }
+            break;
+        case Activation::Tanh:
+            if (ACTIVATION_FAST_EXP) { Simd<T>().Tanh(values, n); break; }
+            for (long i = 0; i < n; i++) { values[i] = tanh(values[i]); }
+            break;
+        case Activation::ReLU:
+            Simd<T>().ReLU(values, n, 0);
+            break;
+        case Activation::LeakyReLU:
+            Simd<T>().ReLU(values, n, (T)LEAKY_RELU_SLOPE);
+            break;
+        case Activation::Softmax:
+            for (long b = 0; b < count; b++) { Softmax(values + b * width, width); }
+            break;
+    }
+}
+
+
+// result = f'(x) of n neurons from their outputs y (element wise, see ActivationBackward for Softmax)
+template<typename T>
+void ActivationPrimes(Activation activation, const T* y, T* result, long n) {
+    for (long i = 0; i < n; i++) { result[i] = ActivationPrime(activation, y[i]); }
+}
+
+
+// Backpropagate the error deltas through the activation of "count" samples of "width" neurons (in place):
+// delta = delta * f'(x), for Softmax the Jacobian product  delta_i = y_i * (delta_i - sum_j(delta_j * y_j))
+template<typename T>
+void ActivationBackward(Activation activation, T* delta, const T* y, long width, long count) {
+    if (activation != Activation::Softmax) {
+        for (long i = 0; i < width * count; i++) { delta[i] *= ActivationPrime(activation, y[i]); }
+        return;
+    }
+    for (long b = 0; b < count; b++) {
+        T* d = delta + b * width;
+        const T* s = y + b * width;
+        T dot = 0;
+        for (long i = 0; i < width; i++) { dot += d[i] * s[i]; }
+        for (long i = 0; i < width; i++) { d[i] = s[i] * (d[i] - dot); }
+    }
+}
@@ -0,0 +1,207 @@
+//  NetCheckpoint.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+
+#include "NetModel.h"
+
+// Checkpoints of a training run: A model file (weights, biases and the optimizer state, see NetModel.h,
+// so a checkpoint can be imported like any model) followed by a NetTrainingState trailer with the
+// position of the run (epoch / sample), the shuffle seed of the NetPipeline and everything else a
+// resumed run needs to continue exactly where the checkpoint was taken.
+// The training thread copies its state into one of two buffers and goes on, a writer thread writes
+// the other one (to "path.tmp", renamed to "path" when complete, so a crash never leaves a broken checkpoint).
+// If the writer is still busy with both buffers, the checkpoint is skipped instead of stalling training.
+
+#define CHECKPOINT_MAGIC            "NNCKPT1"                   // 8 Bytes with the terminating 0
+#define CHECKPOINT_INTERVAL         10000                       // Trained samples between two checkpoints
+
+struct NetTrainingState {
+    char magic[8];
+    uint64_t seed;                          // Shuffle seed of the run (see NetPipeline.h)
+    uint64_t epoch;                         // Position of the next batch
+    uint64_t sample;
+    uint64_t batchSize;
+    uint64_t gradientShards;                // NeuralNetVec: shards of a batch (same rounding of the gradient sums)
+    double recentAverageError;              // NeuralNetOOP
+    double momentum, beta1, beta2, epsilon; // Optimizer settings (see NetOptimizer.h)
+    uint8_t reserved[40];
+};
+static_assert(sizeof(NetTrainingState) == 128, "The training state has to be 128 Bytes");
+
+
+// Everything one checkpoint holds (T = scalar type of the net)
+template<typename T>
+struct NetCheckpointData {
+    Topology layers;
+    double learningRate;
+    ModelOptimizer optimizer;
+    ulong optimizerStep;
+    Activation hiddenActivation, outputActivation;
+    std::vector<std::vector<T>> weights, biases;
+    std::vector<std::vector<std::vector<T>>> slotWeights, slotBiases;
+    NetTrainingState state;
+    
+    NetCheckpointData() : learningRate(0.0), optimizer(ModelOptimizer::SGD), optimizerStep(0),
+      hiddenActivation(Activation::Sigmoid), outputActivation(Activation::Sigmoid) {
+        memset(&state, 0, sizeof(state));
+        memcpy(state.magic, CHECKPOINT_MAGIC, sizeof(state.magic));
+    }
+};
+
+
+// Read the training state of a checkpoint (the last 128 Bytes of the file)
+inline bool ReadTrainingState(const std::string& path, NetTrainingState& state) {
+    std::ifstream file(path, std::ifstream::in | std::ifstream::binary | std::ifstream::ate);
+    if (!file.is_open() || file.tellg() < (std::streamoff)(sizeof(NetModelHeader) + sizeof(NetTrainingState))) {
+        std::cout <<"ERROR: " <<path <<" is not a checkpoint" <<std::endl;
+        return false;
+    }
+    file.seekg(-(std::streamoff)sizeof(NetTrainingState), std::ifstream::end);
+    file.read((char*)&state, sizeof(state));
+    if (!file.good() || memcmp(state.magic, CHECKPOINT_MAGIC, sizeof(state.magic)) != 0) {
+        std::cout <<"ERROR: " <<path <<" is a model without training state" <<std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+template<typename T>
+class NetCheckpointWriter {
+private:
+    const std::string _path;
+    NetCheckpointData<T> _buffers[2];
+    long _next;                             // Buffer the training thread fills next
+    long _pending;                          // Submitted buffer the writer has not started yet (-1 = none)
+    long _active;                           // Buffer the writer is writing (-1 = none)
+    bool _stop;
+    ulong _written, _skipped;
+    std::mutex _mutex;
+    std::condition_variable _wake, _done;
+    std::thread _writer;
+    
+public:
+    NetCheckpointWriter(const std::string& path)
+    : _path(path), _next(0), _pending(-1), _active(-1), _stop(false), _written(0), _skipped(0) {
+        _writer = std::thread(&NetCheckpointWriter::Write, this);
+    }
+    
+    // Writes the last submitted checkpoint before it returns
+    ~NetCheckpointWriter() {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _wake.notify_one();
+        _writer.join();
+    }
+    
+    NetCheckpointWriter(const NetCheckpointWriter&) = delete;
+    NetCheckpointWriter& operator=(const NetCheckpointWriter&) = delete;
+    
+    
+    // The buffer for the next checkpoint, nullptr while the writer still writes it (never waits)
+    NetCheckpointData<T>* Acquire() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_next == _active) {
+            _skipped++;
+            return nullptr;
+        }
+        return &_buffers[_next];
+    }
+    
+    // Hand the acquired buffer to the writer (replaces a submitted checkpoint the writer has not started yet)
+    void Submit() {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _pending = _next;
+            _next ^= 1;
+        }
+        _wake.notify_one();
+    }
+    
+    // Wait until the submitted checkpoints are on disk
+    void Flush() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this]() { return _pending < 0 && _active < 0; });
+    }
+    
+    inline const std::string& path() const { return _path; }
+    inline ulong written() const { return _written; }
+    inline ulong skipped() const { return _skipped; }
+    
+private:
+    void Write() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;) {
+            _wake.wait(lock, [this]() { return _pending >= 0 || _stop; });
+            if (_pending < 0) { return; }
+            _active = _pending;
+            _pending = -1;
+            lock.unlock();
+            const bool written = WriteCheckpoint(_buffers[_active]);
+            lock.lock();
+            if (written) { _written++; }
+            _active = -1;
+            _done.notify_all();
+        }
+    }
+    
+    bool WriteCheckpoint(const NetCheckpointData<T>& data) const {
+        std::vector<char> buffer = NetModelBytes(data.layers, data.learningRate, data.optimizer, data.weights, data.biases, data.slotWeights,
+                                                 data.slotBiases, data.optimizerStep, data.hiddenActivation, data.outputActivation);
+        buffer.insert(buffer.end(), (const char*)&data.state, (const char*)&data.state + sizeof(data.state));
+        const std::string temporary = _path + ".tmp";
+        {
+            std::fstream file (temporary, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+            if (!file.is_open()) {
+                std::cout <<"ERROR: writing the checkpoint " <<temporary <<std::endl;
+                return false;
+            }
+            file.write(buffer.data(), buffer.size());
+            if (!file.good()) {
+                std::cout <<"ERROR: writing the checkpoint " <<temporary <<std::endl;
+                return false;
+            }
+        }
+        if (std::rename(temporary.c_str(), _path.c_str()) != 0) {
+            std::cout <<"ERROR: replacing the checkpoint " <<_path <<std::endl;
+            return false;
+        }
+        return true;
+    }
+};
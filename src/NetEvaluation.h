@@ -0,0 +1,113 @@
+//  NetEvaluation.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+
+#include "MNIST.h"
+
+// Scoring of a net on a data set, without any string building: Both nets feed the digits
+// forward (NeuralNetVec batched and multi-threaded) and add every output to a NetEvaluation.
+// Per-digit consumers (e.g. the reports of test(), see NetReport.h) are optional and get the
+// outputs in the order of the data set.
+
+#define EVALUATION_BATCH            64                          // Digits per batch (and per thread task) of NeuralNetVec::Evaluate
+#define EVALUATION_TOP_K            3                           // Default k of the top-k accuracy
+
+
+struct NetEvaluation {
+    ulong samples;
+    ulong correct;                          // Strongest output neuron == label
+    ulong topKCorrect;                      // Label among the k strongest output neurons
+    long topK;
+    double lossSum;                         // Sum of the mean squared output errors
+    std::vector<ulong> confusion;           // [label * MNIST_CLASSES + strongest output neuron]
+    // Set by Finish()
+    double accuracy, topKAccuracy;          // % of the samples
+    double meanLoss;                        // Mean squared error per output neuron and sample
+
+    NetEvaluation(long k = EVALUATION_TOP_K)
+    : samples(0), correct(0), topKCorrect(0), topK(std::max<long>(1, std::min<long>(k, MNIST_CLASSES))), lossSum(0.0),
+      confusion(MNIST_CLASSES * MNIST_CLASSES, 0), accuracy(0.0), topKAccuracy(0.0), meanLoss(0.0) { }
+
+
+    // Score the MNIST_CLASSES outputs of one digit
+    template<typename T>
+    void Add(const T* output, int label) {
+        long guess = 0, stronger = 0;
+        double loss = 0.0;
+        for (long o = 0; o < MNIST_CLASSES; o++) {
+            if (output[o] > output[guess]) { guess = o; }
+            // Rank of the label: outputs above it (ties count for the lower class, like the argmax)
+            if (output[o] > output[label] || (output[o] == output[label] && o < label)) { stronger++; }
+            const double delta = (o == label) - (double)output[o];
+            loss += (delta * delta);
+        }
+        samples++;
+        if (guess == label) { correct++; }
+        if (stronger < topK) { topKCorrect++; }
+        lossSum += (loss / MNIST_CLASSES);
+        confusion[label * MNIST_CLASSES + guess]++;
+    }
+
+    void Merge(const NetEvaluation& other) {
+        samples += other.samples;
+        correct += other.correct;
+        topKCorrect += other.topKCorrect;
+        lossSum += other.lossSum;
+        for (ulong i = 0; i < confusion.size(); i++) { confusion[i] += other.confusion[i]; }
+    }
+
+    void Reset() {
+        samples = correct = topKCorrect = 0;
+        lossSum = accuracy = topKAccuracy = meanLoss = 0.0;
+        std::fill(confusion.begin(), confusion.end(), 0);
+    }
+
+    NetEvaluation& Finish() {
+        accuracy = samples ? (100.0 * correct) / samples : 0.0;
+        topKAccuracy = samples ? (100.0 * topKCorrect) / samples : 0.0;
+        meanLoss = samples ? lossSum / samples : 0.0;
+        return *this;
+    }
+
+    inline ulong confusionAt(long label, long guess) const { return confusion[label * MNIST_CLASSES + guess]; }
+};
+
+
+// Receives the outputs of every evaluated digit, in the order of the data set
+class NetResultConsumer {
+public:
+    virtual ~NetResultConsumer() { }
+    virtual void Consume(const MNISTchar& digit, const double* output) = 0;
+};
+
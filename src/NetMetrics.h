@@ -0,0 +1,299 @@
+//  NetMetrics.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <sstream>
+
+#include "NetBase.h"
+
+// Training instrumentation of both nets: time per phase (data fetch, forward, backward, weight update),
+// trained samples, running loss and the busy share of every training thread.
+// Every training thread adds to its own counters (relaxed atomics, no locks and no shared cache lines),
+// a sampler thread reads them every METRICS_INTERVAL ms and passes the deltas to a callback and / or
+// writes them as one JSON line. With NET_METRICS false the timers and counter updates are empty inline
+// functions, so the instrumentation compiles away (the nets only keep the pointer to their NetMetrics).
+
+#define METRICS_INTERVAL            1000                        // Milliseconds between two samples
+#define METRICS_PHASES              4
+
+enum class NetPhase { Fetch = 0, Forward = 1, Backward = 2, Update = 3 };
+
+inline const char* NetPhaseName(NetPhase phase) {
+    switch (phase) {
+        case NetPhase::Fetch:       return "fetch";
+        case NetPhase::Forward:     return "forward";
+        case NetPhase::Backward:    return "backward";
+        case NetPhase::Update:      return "update";
+    }
+    return "unknown";
+}
+
+
+// Counters of one training thread: Only this thread writes them (relaxed load + store, no locked
+// instructions), the sampler reads them. Padded to two cache lines, so the counters of two threads
+// never share a line (the heap only aligns to 16 Bytes)
+struct NetThreadCounters {
+    std::atomic<uint64_t> phaseNanos[METRICS_PHASES];
+    std::atomic<uint64_t> samples;
+    std::atomic<double> lossSum;            // Sum of the mean squared output errors of the samples
+    char padding[128 - (METRICS_PHASES + 2) * 8];
+    
+    NetThreadCounters() : samples(0), lossSum(0.0) {
+        for (long p = 0; p < METRICS_PHASES; p++) { phaseNanos[p].store(0); }
+    }
+    
+    inline void AddTime(NetPhase phase, uint64_t nanos) { Add(phaseNanos[(long)phase], nanos); }
+    inline void AddSamples(long count, double loss) {
+        Add(samples, count);
+        lossSum.store(lossSum.load(std::memory_order_relaxed) + loss, std::memory_order_relaxed);
+    }
+    
+private:
+    static inline void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+};
+
+
+// Adds the time from construction to Stop() / destruction to a phase (nothing without counters)
+#if NET_METRICS
+class NetPhaseTimer {
+private:
+    NetThreadCounters* _counters;
+    const NetPhase _phase;
+    std::chrono::steady_clock::time_point _start;
+    
+public:
+    NetPhaseTimer(NetThreadCounters* counters, NetPhase phase) : _counters(counters), _phase(phase) {
+        if (_counters) { _start = std::chrono::steady_clock::now(); }
+    }
+    ~NetPhaseTimer() { Stop(); }
+    
+    inline void Stop() {
+        if (!_counters) { return; }
+        _counters->AddTime(_phase, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count());
+        _counters = nullptr;
+    }
+};
+#else
+class NetPhaseTimer {
+public:
+    NetPhaseTimer(NetThreadCounters*, NetPhase) { }
+    inline void Stop() { }
+};
+#endif
+
+
+// Count "count" trained samples (outputs / expected outputs back to back) with their loss
+template<typename T>
+inline void MetricsAddSamples(NetThreadCounters* counters, const T* output, const T* expected, long outputs, long count) {
+#if NET_METRICS
+    if (!counters) { return; }
+    double loss = 0.0;
+    for (long i = 0; i < outputs * count; i++) { loss += (output[i] - expected[i]) * (output[i] - expected[i]); }
+    counters->AddSamples(count, loss / outputs);
+#else
+    (void)counters; (void)output; (void)expected; (void)outputs; (void)count;
+#endif
+}
+
+
+// One sample of the metrics: the changes since the previous sample
+struct NetMetricsSample {
+    double time;                            // Seconds since Start()
+    double interval;                        // Seconds since the previous sample
+    uint64_t samples;                       // Trained samples since Start()
+    double samplesPerSec;
+    double loss;                            // Mean loss of the samples in the interval (mean squared error per output neuron)
+    double phaseSeconds[METRICS_PHASES];    // Time of all threads per phase
+    std::vector<double> utilisation;        // Busy share (time in the phases) of every thread: 0.0 .. 1.0
+    
+    std::string Json() const {
+        std::ostringstream json;
+        json << "{\"time\": " << time << ", \"samples\": " << samples << ", \"samplesPerSec\": " << samplesPerSec << ", \"loss\": " << loss;
+        for (long p = 0; p < METRICS_PHASES; p++) { json << ", \"" << NetPhaseName((NetPhase)p) << "\": " << phaseSeconds[p]; }
+        json << ", \"utilisation\": [";
+        for (size_t t = 0; t < utilisation.size(); t++) { json << (t ? ", " : "") << utilisation[t]; }
+        json << "]}";
+        return json.str();
+    }
+};
+
+
+class NetMetrics {
+public:
+    typedef std::function<void(const NetMetricsSample&)> Callback;
+    
+private:
+    struct Snapshot {
+        uint64_t phaseNanos[METRICS_PHASES];
+        uint64_t samples;
+        double lossSum;
+    };
+    
+    std::vector<std::unique_ptr<NetThreadCounters>> _threads;
+    std::vector<Snapshot> _previous;
+    const long _intervalMs;
+    Callback _callback;
+    std::ofstream _file;                    // JSON lines
+    std::chrono::steady_clock::time_point _start, _last;
+    uint64_t _totalSamples;
+    std::mutex _mutex;                      // Sample(), Start(), Stop()
+    std::condition_variable _wake;
+    std::thread _sampler;
+    bool _running;
+    
+public:
+    // threads: training threads with their own counters (0 = one per core)
+    NetMetrics(long threads = 0, long intervalMs = METRICS_INTERVAL)
+    : _intervalMs(std::max<long>(1, intervalMs)), _totalSamples(0), _running(false) {
+        if (threads <= 0) { threads = std::max<long>(1, std::thread::hardware_concurrency()); }
+        for (long t = 0; t < threads; t++) { _threads.push_back(std::unique_ptr<NetThreadCounters>(new NetThreadCounters())); }
+        _previous.resize(threads);
+        _start = _last = std::chrono::steady_clock::now();
+    }
+    
+    ~NetMetrics() { Stop(); }
+    
+    NetMetrics(const NetMetrics&) = delete;
+    NetMetrics& operator=(const NetMetrics&) = delete;
+    
+    
+    // The counters of training thread t (nullptr = not counted: threads beyond the capacity never share counters,
+    // the updates are plain loads and stores of the owning thread)
+    inline NetThreadCounters* Thread(long t) { return (t >= 0 && t < ThreadCount()) ? _threads[t].get() : nullptr; }
+    inline long ThreadCount() const { return _threads.size(); }
+    
+    // Where the samples go: a callback (on the sampler thread) and / or a JSON lines file
+    // (Set before Start. The callback runs without the lock held, so it may call Sample)
+    void OnSample(const Callback& callback) { _callback = callback; }
+    
+    bool WriteTo(const std::string& path) {
+        _file.open(path, std::ofstream::out | std::ofstream::trunc);
+        if (!_file.is_open()) {
+            std::cout <<"ERROR: writing the metrics to " <<path <<std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    
+    // Sample every METRICS_INTERVAL ms on a background thread until Stop()
+    void Start() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_running) { return; }
+        _running = true;
+        _start = _last = std::chrono::steady_clock::now();
+        for (long t = 0; t < ThreadCount(); t++) { _previous[t] = Read(*_threads[t]); }
+        _sampler = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(_mutex);
+            while (!_wake.wait_for(lock, std::chrono::milliseconds(_intervalMs), [this]() { return !_running; })) {
+                const NetMetricsSample sample = TakeSample();
+                lock.unlock();
+                Emit(sample);
+                lock.lock();
+            }
+        });
+    }
+    
+    // Stop the sampler and emit the last (partial) interval
+    void Stop() {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_running) { return; }
+            _running = false;
+        }
+        _wake.notify_all();
+        _sampler.join();
+        std::unique_lock<std::mutex> lock(_mutex);
+        const NetMetricsSample sample = TakeSample();
+        lock.unlock();
+        Emit(sample);
+        _file.flush();
+    }
+    
+    // Sample right now (the next sample covers the time from here on)
+    NetMetricsSample Sample() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return TakeSample();
+    }
+    
+private:
+    static Snapshot Read(const NetThreadCounters& counters) {
+        Snapshot snapshot;
+        for (long p = 0; p < METRICS_PHASES; p++) { snapshot.phaseNanos[p] = counters.phaseNanos[p].load(std::memory_order_relaxed); }
+        snapshot.samples = counters.samples.load(std::memory_order_relaxed);
+        snapshot.lossSum = counters.lossSum.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+    
+    NetMetricsSample TakeSample() {
+        const auto now = std::chrono::steady_clock::now();
+        NetMetricsSample sample;
+        sample.time = std::chrono::duration<double>(now - _start).count();
+        sample.interval = std::chrono::duration<double>(now - _last).count();
+        std::fill(sample.phaseSeconds, sample.phaseSeconds + METRICS_PHASES, 0.0);
+        uint64_t samples = 0;
+        double lossSum = 0.0;
+        for (long t = 0; t < ThreadCount(); t++) {
+            const Snapshot current = Read(*_threads[t]);
+            double busy = 0.0;
+            for (long p = 0; p < METRICS_PHASES; p++) {
+                const double seconds = (current.phaseNanos[p] - _previous[t].phaseNanos[p]) * 1e-9;
+                sample.phaseSeconds[p] += seconds;
+                busy += seconds;
+            }
+            samples += current.samples - _previous[t].samples;
+            lossSum += current.lossSum - _previous[t].lossSum;
+            sample.utilisation.push_back((sample.interval > 0.0) ? std::min(1.0, busy / sample.interval) : 0.0);
+            _previous[t] = current;
+        }
+        _totalSamples += samples;
+        sample.samples = _totalSamples;
+        sample.samplesPerSec = (sample.interval > 0.0) ? samples / sample.interval : 0.0;
+        sample.loss = (samples > 0) ? lossSum / samples : 0.0;
+        _last = now;
+        return sample;
+    }
+    
+    // (Called without the lock: only the sampler thread, or Stop after it ended, emits)
+    void Emit(const NetMetricsSample& sample) {
+        if (_callback) { _callback(sample); }
+        if (_file.is_open()) { _file << sample.Json() << "\n"; }
+    }
+};
@@ -0,0 +1,314 @@
+//  NetModel.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <memory>
+#include <limits>
+#include <algorithm>
+
+#include "Settings.h"
+#include "MappedFile.h"
+#include "NetActivation.h"
+
+// Binary model file shared by both nets (a model exported by one can be imported by the other):
+//   header:    NetModelHeader (64 Bytes)
+//   topology:  layerCount x uint64 neurons per layer (without bias neurons)
+//   arrays:    for every layer i (0 .. layerCount-2), each array starting on a MODEL_ALIGNMENT boundary:
+//                weights   W[i]  (layers[i+1] x layers[i] values, row-major)
+//                biases    B[i]  (layers[i+1] values)
+//              followed by the optimizer state, "optimizerSlots" arrays of the weight and of the bias shape per layer
+// (Files may hold more data after the model, e.g. the training state of a checkpoint, see NetCheckpoint.h)
+// Everything is stored in the byte order and precision (float or double) of the writing net (checked
+// when reading), so a mapped model can be used in place: NeuralNetVec runs inference straight on the
+// mapped weights. Loading a model into a net of the other precision converts the values.
+
+#define MODEL_MAGIC                 "NNMODEL"                   // 8 Bytes with the terminating 0
+#define MODEL_VERSION               1
+#define MODEL_BYTE_ORDER            0x01020304                  // Reads back as 0x04030201 on the other byte order
+#define MODEL_ALIGNMENT             64                          // Cache line (and AVX-512 register) size
+#define MODEL_MAX_NEURONS           (1ull << 31)                // Max. neurons per layer (the array sizes are checked separately)
+
+// Optimizer state stored next to the weights
+enum class ModelOptimizer : uint32_t {
+    SGD = 0,                                // No state
+    Momentum = 1,                           // 1 slot: the last delta of every weight / bias
+    Nesterov = 2,                           // 1 slot: the last delta of every weight / bias (without the look ahead step)
+    Adam = 3                                // 2 slots: first and second moment of the gradients
+};
+
+inline ulong ModelOptimizerSlots(ModelOptimizer optimizer) {
+    switch (optimizer) {
+        case ModelOptimizer::Momentum:
+        case ModelOptimizer::Nesterov: return 1;
+        case ModelOptimizer::Adam:     return 2;
+        default:                       return 0;
+    }
+}
+
+struct NetModelHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t scalarBytes;                   // sizeof(float) or sizeof(double)
+    uint32_t layerCount;
+    uint32_t optimizer;                     // ModelOptimizer
+    uint32_t optimizerSlots;
+    double learningRate;
+    uint64_t fileSize;                      // Expected size, to detect truncated files
+    uint64_t optimizerStep;                 // Updates done by the optimizer (Adam bias correction)
+    uint8_t hiddenActivation;               // Activation (0 = Sigmoid, so older models read as sigmoid nets)
+    uint8_t outputActivation;               // Activation
+    uint8_t reserved[6];
+};
+static_assert(sizeof(NetModelHeader) == 64, "The model header has to be 64 Bytes");
+
+
+// Byte offsets of all the arrays of a model: [layer] for the weights / biases and [slot][layer] for the optimizer state
+struct NetModelLayout {
+    std::vector<ulong> weights, biases;
+    std::vector<std::vector<ulong>> slotWeights, slotBiases;
+    ulong fileSize;
+
+    NetModelLayout(const Topology& layers, ulong optimizerSlots, ulong scalarBytes) {
+        const ulong lastLayer = layers.size() - 1;
+        ulong offset = sizeof(NetModelHeader) + (layers.size() * sizeof(uint64_t));
+        auto next = [&offset, scalarBytes](ulong count) {
+            const ulong start = (offset + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+            offset = start + count * scalarBytes;
+            return start;
+        };
+        for (ulong i = 0; i < lastLayer; i++) {
+            weights.push_back(next(layers[i + 1] * layers[i]));
+            biases.push_back(next(layers[i + 1]));
+        }
+        slotWeights = std::vector<std::vector<ulong>>(optimizerSlots);
+        slotBiases = std::vector<std::vector<ulong>>(optimizerSlots);
+        for (ulong s = 0; s < optimizerSlots; s++) {
+            for (ulong i = 0; i < lastLayer; i++) {
+                slotWeights[s].push_back(next(layers[i + 1] * layers[i]));
+                slotBiases[s].push_back(next(layers[i + 1]));
+            }
+        }
+        fileSize = offset;
+    }
+};
+
+
+// The bytes of a model file: weights / biases per layer, slotWeights / slotBiases per [slot][layer] (T = float or double)
+// (Built in memory with zero padding between the arrays, so the file can be written at once)
+template<typename T>
+std::vector<char> NetModelBytes(const Topology& layers, double learningRate, ModelOptimizer optimizer,
+                                const std::vector<std::vector<T>>& weights, const std::vector<std::vector<T>>& biases,
+                                const std::vector<std::vector<std::vector<T>>>& slotWeights, const std::vector<std::vector<std::vector<T>>>& slotBiases,
+                                ulong optimizerStep, Activation hiddenActivation, Activation outputActivation) {
+    const NetModelLayout layout(layers, slotWeights.size(), sizeof(T));
+    std::vector<char> buffer(layout.fileSize, 0);
+    NetModelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+    header.version = MODEL_VERSION;
+    header.byteOrder = MODEL_BYTE_ORDER;
+    header.scalarBytes = sizeof(T);
+    header.layerCount = layers.size();
+    header.optimizer = (uint32_t)optimizer;
+    header.optimizerSlots = slotWeights.size();
+    header.learningRate = learningRate;
+    header.fileSize = layout.fileSize;
+    header.optimizerStep = optimizerStep;
+    header.hiddenActivation = (uint8_t)hiddenActivation;
+    header.outputActivation = (uint8_t)outputActivation;
+    memcpy(buffer.data(), &header, sizeof(header));
+    for (ulong i = 0; i < layers.size(); i++) {
+        const uint64_t neurons = layers[i];
+        memcpy(buffer.data() + sizeof(header) + (i * sizeof(uint64_t)), &neurons, sizeof(uint64_t));
+    }
+    auto put = [&buffer](ulong offset, const std::vector<T>& values) {
+        memcpy(buffer.data() + offset, values.data(), values.size() * sizeof(T));
+    };
+    for (ulong i = 0; i < weights.size(); i++) {
+        put(layout.weights[i], weights[i]);
+        put(layout.biases[i], biases[i]);
+    }
+    for (ulong s = 0; s < slotWeights.size(); s++) {
+        for (ulong i = 0; i < weights.size(); i++) {
+            put(layout.slotWeights[s][i], slotWeights[s][i]);
+            put(layout.slotBiases[s][i], slotBiases[s][i]);
+        }
+    }
+    return buffer;
+}
+
+
+// Write a model file (see NetModelBytes)
+template<typename T>
+bool WriteNetModel(const std::string& path, const Topology& layers, double learningRate, ModelOptimizer optimizer,
+                   const std::vector<std::vector<T>>& weights, const std::vector<std::vector<T>>& biases,
+                   const std::vector<std::vector<std::vector<T>>>& slotWeights = {}, const std::vector<std::vector<std::vector<T>>>& slotBiases = {},
+                   ulong optimizerStep = 0, Activation hiddenActivation = Activation::Sigmoid, Activation outputActivation = Activation::Sigmoid) {
+    const std::vector<char> buffer = NetModelBytes(layers, learningRate, optimizer, weights, biases, slotWeights, slotBiases,
+                                                   optimizerStep, hiddenActivation, outputActivation);
+    std::fstream file (path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+    if (!file.is_open()) {
+        std::cout <<"ERROR: writing the model " <<path <<std::endl;
+        return false;
+    }
+    file.write(buffer.data(), buffer.size());
+    return file.good();
+}
+
+
+// Memory mapped model file: The header is validated once, the arrays are used in place
+class NetModel {
+private:
+    MappedFile _file;
+    Topology _layers;
+    const NetModelHeader* _header;
+    std::unique_ptr<NetModelLayout> _layout;
+
+public:
+    NetModel(const std::string& path) : _file(path), _header(nullptr) {
+        if (!_file.isOpen()) {
+            std::cout <<"ERROR: opening the model " <<path <<std::endl;
+            return;
+        }
+        const NetModelHeader* header = (const NetModelHeader*)_file.data();
+        if (_file.size() < sizeof(NetModelHeader) || memcmp(header->magic, MODEL_MAGIC, sizeof(header->magic)) != 0) {
+            std::cout <<"ERROR: " <<path <<" is not a model file" <<std::endl;
+            return;
+        }
+        if (header->version != MODEL_VERSION || header->byteOrder != MODEL_BYTE_ORDER
+            || (header->scalarBytes != sizeof(float) && header->scalarBytes != sizeof(double))) {
+            std::cout <<"ERROR: " <<path <<" has version " <<header->version <<" (expected " <<MODEL_VERSION
+                      <<") or was written with an other byte order / precision" <<std::endl;
+            return;
+        }
+        if (header->hiddenActivation >= (uint8_t)Activation::Softmax || header->outputActivation > (uint8_t)Activation::Softmax) {
+            std::cout <<"ERROR: " <<path <<" has an unsupported activation function (Softmax only on the output layer)" <<std::endl;
+            return;
+        }
+        if (header->layerCount < 2 || header->layerCount > (_file.size() - sizeof(NetModelHeader)) / sizeof(uint64_t)) {
+            std::cout <<"ERROR: " <<path <<" has a broken topology" <<std::endl;
+            return;
+        }
+        if (header->optimizer > (uint32_t)ModelOptimizer::Adam || header->optimizerSlots != ModelOptimizerSlots((ModelOptimizer)header->optimizer)) {
+            std::cout <<"ERROR: " <<path <<" has an unknown optimizer or a broken optimizer state" <<std::endl;
+            return;
+        }
+        for (ulong i = 0; i < header->layerCount; i++) {
+            uint64_t neurons = 0;
+            memcpy(&neurons, _file.data() + sizeof(NetModelHeader) + (i * sizeof(uint64_t)), sizeof(uint64_t));
+            if (neurons == 0 || neurons > MODEL_MAX_NEURONS) {
+                std::cout <<"ERROR: " <<path <<" has a layer with " <<neurons <<" neurons" <<std::endl;
+                _layers.clear();
+                return;
+            }
+            _layers.push_back(neurons);
+        }
+        // (The arrays are checked against the file size first, the offsets of a forged topology could wrap)
+        if (!Fits(_layers, header->optimizerSlots, header->scalarBytes, _file.size())) {
+            std::cout <<"ERROR: " <<path <<" is truncated or does not match its topology" <<std::endl;
+            _layers.clear();
+            return;
+        }
+        _layout.reset(new NetModelLayout(_layers, header->optimizerSlots, header->scalarBytes));
+        if (header->fileSize != _layout->fileSize || _file.size() < _layout->fileSize) {
+            std::cout <<"ERROR: " <<path <<" is truncated or does not match its topology" <<std::endl;
+            _layers.clear();
+            _layout.reset();
+            return;
+        }
+        _header = header;
+    }
+
+    NetModel(const NetModel&) = delete;
+    NetModel& operator=(const NetModel&) = delete;
+
+
+    // GETTER
+    inline bool isValid() const { return _header != nullptr; }
+    inline const Topology& layers() const { return _layers; }
+    inline double learningRate() const { return _header->learningRate; }
+    inline ModelOptimizer optimizer() const { return (ModelOptimizer)_header->optimizer; }
+    inline ulong optimizerSlots() const { return _header->optimizerSlots; }
+    inline ulong optimizerStep() const { return _header->optimizerStep; }
+    inline Activation hiddenActivation() const { return (Activation)_header->hiddenActivation; }
+    inline Activation outputActivation() const { return (Activation)_header->outputActivation; }
+    inline ulong scalarBytes() const { return _header->scalarBytes; }
+
+    // Pointers into the mapping (only valid if the model stores T values, see scalarBytes)
+    template<typename T> inline const T* weights(ulong layer) const { return At<T>(_layout->weights[layer]); }
+    template<typename T> inline const T* biases(ulong layer) const { return At<T>(_layout->biases[layer]); }
+
+    // Copy an array into T values (converts float <-> double models)
+    template<typename T> void copyWeights(ulong layer, T* out) const { Copy(_layout->weights[layer], WeightCount(layer), out); }
+    template<typename T> void copyBiases(ulong layer, T* out) const { Copy(_layout->biases[layer], _layers[layer + 1], out); }
+    template<typename T> void copySlotWeights(ulong slot, ulong layer, T* out) const { Copy(_layout->slotWeights[slot][layer], WeightCount(layer), out); }
+    template<typename T> void copySlotBiases(ulong slot, ulong layer, T* out) const { Copy(_layout->slotBiases[slot][layer], _layers[layer + 1], out); }
+
+private:
+    // The arrays of the topology (model and optimizer state, laid out as in NetModelLayout) fit into "size" bytes
+    // (Computed in uint64_t with overflow checks, since ulong has only 32 bits on Windows: every array and offset
+    // has to fit ulong and size_t as well, so NetModelLayout and WeightCount never see wrapped values)
+    static bool Fits(const Topology& layers, ulong optimizerSlots, ulong scalarBytes, ulong size) {
+        const uint64_t limit = std::min<uint64_t>(std::min<uint64_t>(size, std::numeric_limits<ulong>::max()), SIZE_MAX);
+        uint64_t offset = sizeof(NetModelHeader) + ((uint64_t)layers.size() * sizeof(uint64_t));
+        auto next = [&offset, scalarBytes, limit](uint64_t rows, uint64_t columns) {
+            if (columns != 0 && rows > UINT64_MAX / columns) { return false; }
+            const uint64_t count = rows * columns;
+            offset = (offset + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+            if (offset > limit || count > (limit - offset) / scalarBytes) { return false; }
+            offset += count * scalarBytes;
+            return true;
+        };
+        // (Slot 0 = the weights and biases themselves)
+        for (ulong s = 0; s <= optimizerSlots; s++) {
+            for (ulong i = 0; i + 1 < layers.size(); i++) {
+                if (!next(layers[i + 1], layers[i]) || !next(layers[i + 1], 1)) { return false; }
+            }
+        }
+        return true;
+    }
+
+    template<typename T>
+    inline const T* At(ulong offset) const { return (const T*)(_file.data() + offset); }
+
+    inline ulong WeightCount(ulong layer) const { return _layers[layer + 1] * _layers[layer]; }
+
+    template<typename T>
+    void Copy(ulong offset, ulong count, T* out) const {
+        if (_header->scalarBytes == sizeof(double)) { std::copy(At<double>(offset), At<double>(offset) + count, out); }
+        else { std::copy(At<float>(offset), At<float>(offset) + count, out); }
+    }
+
+};
@@ -0,0 +1,162 @@
+//  NetPipeline.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <numeric>
+
+#include "MNIST.h"
+
+// Input pipeline of the training loops: A producer thread draws a new permutation of the sample
+// indices every epoch (only the indices are shuffled, the digits stay where they are). The permutation
+// only depends on the seed and the epoch, so a run can be resumed at any batch (see NetCheckpoint.h). It assembles
+// the next batches into a ring of PIPELINE_DEPTH preallocated buffers. Converting the pixels to the
+// net precision and expanding the labels happens there as well, while the training thread works on
+// the current batch. The ring is the bounded queue between the two: the producer waits while all
+// buffers are full, the training thread only waits if the producer falls behind.
+// (T = scalar type of the net, one consumer thread)
+
+#define PIPELINE_DEPTH              3                           // Batch buffers (the training thread holds one, the producer fills the others)
+
+
+// One assembled batch: "count" samples back to back
+template<typename T>
+struct NetBatch {
+    std::vector<T> input;                   // Normalized pixels (count x imageSize)
+    std::vector<T> expectedOutput;          // One-hot labels (count x MNIST_CLASSES)
+    long count;
+    long epoch;
+    ulong first;                            // Position of the first sample in the epoch
+};
+
+
+template<typename T>
+class NetPipeline {
+private:
+    const MNISTset& _data;
+    const long _batchSize, _epochs;
+    const bool _shuffle;
+    const ulong _seed;
+    const long _firstEpoch;
+    const ulong _firstSample;
+    std::vector<ulong> _order;              // Sample indices of the current epoch
+    std::vector<NetBatch<T>> _batches;      // Ring: batch n lives in _batches[n % PIPELINE_DEPTH]
+    long _produced, _consumed, _released;   // Batches filled / handed out / given back by the training thread
+    bool _finished, _stop;
+    std::mutex _mutex;
+    std::condition_variable _filled, _freed;
+    std::thread _producer;
+    
+public:
+    // "epochs" passes over the data, shuffled with "seed" (without shuffling every epoch has the order of the data set).
+    // A resumed run starts at sample "firstSample" of epoch "firstEpoch"
+    NetPipeline(const MNISTset& data, long batchSize, long epochs, bool shuffle, ulong seed = 0, long firstEpoch = 0, ulong firstSample = 0)
+    : _data(data), _batchSize(std::max<long>(1, batchSize)), _epochs(epochs), _shuffle(shuffle), _seed(seed), _firstEpoch(firstEpoch),
+      _firstSample(firstSample), _order(data.size()), _batches(PIPELINE_DEPTH), _produced(0), _consumed(0), _released(0), _finished(false), _stop(false) {
+        for (NetBatch<T>& batch : _batches) {
+            batch.input.resize(_batchSize * data.imageSize());
+            batch.expectedOutput.resize(_batchSize * MNIST_CLASSES);
+            batch.count = batch.epoch = 0;
+            batch.first = 0;
+        }
+        _producer = std::thread(&NetPipeline::Produce, this);
+    }
+    
+    ~NetPipeline() {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _freed.notify_all();
+        _producer.join();
+    }
+    
+    NetPipeline(const NetPipeline&) = delete;
+    NetPipeline& operator=(const NetPipeline&) = delete;
+    
+    
+    // Wait for the next batch, nullptr after the last epoch. Gives the previous batch back to the producer,
+    // so it is only valid until the next call (its buffers may be swapped with equally sized ones in the meantime)
+    NetBatch<T>* Next() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_released < _consumed) {
+            _released++;
+            _freed.notify_one();
+        }
+        _filled.wait(lock, [this]() { return _produced > _consumed || _finished; });
+        if (_produced == _consumed) { return nullptr; }
+        return &_batches[_consumed++ % PIPELINE_DEPTH];
+    }
+    
+    inline long batchSize() const { return _batchSize; }
+    
+private:
+    void Produce() {
+        const long imageSize = _data.imageSize();
+        for (long epoch = _firstEpoch; epoch < _epochs; epoch++) {
+            std::iota(_order.begin(), _order.end(), 0);
+            if (_shuffle) {
+                std::mt19937_64 random(_seed + epoch * 0x9E3779B97F4A7C15ull);
+                std::shuffle(_order.begin(), _order.end(), random);
+            }
+            for (ulong first = (epoch == _firstEpoch) ? _firstSample : 0; first < _order.size(); first += _batchSize) {
+                NetBatch<T>* batch;
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _freed.wait(lock, [this]() { return _produced - _released < PIPELINE_DEPTH || _stop; });
+                    if (_stop) { return; }
+                    batch = &_batches[_produced % PIPELINE_DEPTH];
+                }
+                // The last batch of an epoch may hold less samples
+                batch->count = std::min<long>(_batchSize, _order.size() - first);
+                batch->epoch = epoch;
+                batch->first = first;
+                for (long b = 0; b < batch->count; b++) {
+                    const MNISTchar digit = _data[_order[first + b]];
+                    digit.normalizedPixels(batch->input.data() + b * imageSize);
+                    digit.expectedOutput(batch->expectedOutput.data() + b * MNIST_CLASSES);
+                }
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _produced++;
+                }
+                _filled.notify_one();
+            }
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _finished = true;
+        _filled.notify_one();
+    }
+};
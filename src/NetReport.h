@@ -0,0 +1,271 @@
+//  NetReport.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+
+#include "NetEvaluation.h"
+
+// Test reports written while the evaluation runs: Every digit is formatted straight into the fixed
+// buffer of a NetOutputSink, which is written to the file whenever it is full, so the memory use
+// does not grow with the size of the test set.
+//   Text:    the human readable report (ASCII picture, expected / actual outputs and the guess per digit)
+//   CSV:     one line per digit: label,prediction,score0,...,score9
+//   Binary:  NetResultHeader followed by one NetResultRecord per digit
+
+#define REPORT_BUFFER_SIZE          (64 * 1024)                 // Bytes buffered before a write
+#define REPORT_SUMMARY_WIDTH        63                          // Reserved characters of a summary line of the text report
+#define RESULT_MAGIC                "NNRESLT"                   // 8 Bytes with the terminating 0
+
+enum class ReportFormat { Text, CSV, Binary };
+
+// Binary report: little-endian on all supported platforms, records are packed back to back
+struct NetResultHeader {
+    char magic[8];
+    uint32_t classes;                       // Scores per record
+    uint32_t recordBytes;                   // sizeof(NetResultRecord)
+};
+
+struct NetResultRecord {
+    uint8_t label;
+    uint8_t prediction;                     // Strongest output neuron
+    uint8_t reserved[2];
+    float scores[MNIST_CLASSES];
+};
+static_assert(sizeof(NetResultHeader) == 16 && sizeof(NetResultRecord) == 4 + 4 * MNIST_CLASSES, "Unexpected padding in the result file structs");
+
+
+// Buffered output file
+class NetOutputSink {
+private:
+    std::ofstream _file;
+    std::vector<char> _buffer;
+    ulong _used;
+
+public:
+    NetOutputSink(const std::string& path)
+    : _file(path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc), _buffer(REPORT_BUFFER_SIZE), _used(0) { }
+
+    ~NetOutputSink() { Flush(); }
+
+    NetOutputSink(const NetOutputSink&) = delete;
+    NetOutputSink& operator=(const NetOutputSink&) = delete;
+
+
+    void Write(const void* data, ulong size) {
+        if (_used + size > _buffer.size()) { Flush(); }
+        if (size > _buffer.size()) {
+            _file.write((const char*)data, size);
+            return;
+        }
+        memcpy(_buffer.data() + _used, data, size);
+        _used += size;
+    }
+
+    inline void Write(const char* text) { Write(text, strlen(text)); }
+    inline void Write(char c) { Write(&c, 1); }
+
+    // printf style formatting into the buffer (one item, up to 255 characters)
+    template<typename... Args>
+    void Print(const char* format, Args... args) {
+        char text[256];
+        const int length = snprintf(text, sizeof(text), format, args...);
+        if (length > 0) { Write(text, std::min<ulong>(length, sizeof(text) - 1)); }
+    }
+
+    bool Flush() {
+        if (_used > 0) { _file.write(_buffer.data(), _used); }
+        _used = 0;
+        return _file.good();
+    }
+
+    // Overwrite bytes that were written before (e.g. a header reserved at the start of the file)
+    bool Rewrite(ulong offset, const void* data, ulong size) {
+        Flush();
+        _file.seekp(offset);
+        _file.write((const char*)data, size);
+        _file.seekp(0, std::ofstream::end);
+        return _file.good();
+    }
+
+    // GETTER
+    inline bool isOpen() const { return _file.is_open(); }
+};
+
+
+// A report file that is written by an evaluation (see NetEvaluation.h)
+class NetReport : public NetResultConsumer {
+protected:
+    NetOutputSink _sink;
+
+public:
+    NetReport(const std::string& path) : _sink(path) { }
+
+    // Write the overall results and everything that is still buffered
+    virtual bool Finish(const NetEvaluation& /*evaluation*/) { return _sink.Flush(); }
+
+    inline bool isOpen() const { return _sink.isOpen(); }
+};
+
+
+// Per-digit text report: ASCII picture, expected / actual outputs and the guess of the net for every digit.
+// The summary lines are reserved at the start of the file and filled in by Finish()
+class NetTextReport : public NetReport {
+private:
+    ulong _recognizeCount;
+
+public:
+    NetTextReport(const std::string& path) : NetReport(path), _recognizeCount(0) {
+        const std::string summary = Summary(0.0, 0, 0);
+        _sink.Write(summary.data(), summary.size());
+        _sink.Write("\n\nTest Data Digits:\n\n");
+    }
+
+
+    void Consume(const MNISTchar& t, const double* result) override {
+        _sink.Write("----------------------------------\n");
+        // the current test digit as an ASCII picture (27 characters per line, the last pixel of every line is skipped)
+        char line[28];
+        ulong count = 0;
+        for (const byte& r : t.pixelData) {
+            if (count < 27) {
+                line[count++] = (r < 64) ? ' ' : (r < 128) ? '-' : (r < 192) ? '+' : '#';
+            } else {
+                line[count] = '\n';
+                _sink.Write(line, count + 1);
+                count = 0;
+            }
+        }
+        _sink.Print("\tThis is a: %d\n", t.label);
+        // the exprected / actual results table
+        _sink.Write("\n\n");
+        for (ulong i = 0; i < MNIST_CLASSES; i++) { _sink.Print("%d\t\t\t%f\n", (int)(i == (ulong)t.label), result[i]); }
+        // the networks guess: the Number with the highest possibility ( >= 0.8 )
+        // and check if the other are as low as expected ( <= 0.2 )
+        _sink.Write("\n\n");
+        ulong num = -1, lowCount = 0;
+        for (ulong i = 0; i < MNIST_CLASSES; i++) {
+            if (result[i] >= 0.8f) { num = i; }
+            if (result[i] <= 0.2f) { lowCount++; }
+        }
+        _sink.Print("This is%s\t%lu\n", (lowCount >= 9) ? " definitely a: " : " very likely a: ", num);
+        // Check if the estimated digit is correct
+        if (num == (ulong)t.label) {
+            _recognizeCount++;
+            _sink.Write("Network guessed:\tCORRECT\n");
+        } else {
+            _sink.Write("Network guessed:\tWRONG\n");
+        }
+        _sink.Write("----------------------------------\n");
+    }
+
+
+    bool Finish(const NetEvaluation& evaluation) override {
+        const std::string summary = Summary(evaluation.meanLoss, _recognizeCount, evaluation.samples);
+        return _sink.Rewrite(0, summary.data(), summary.size());
+    }
+
+private:
+    // Overall error and percentage of correctly recognized digits (with a strong guess, see above),
+    // every line padded to REPORT_SUMMARY_WIDTH so the final summary fits into the reserved space
+    static std::string Summary(double error, ulong recognized, ulong samples) {
+        const double percent = samples ? ((double)recognized / samples) * 100.0 : 0.0;
+        const std::string lines[2] = {
+            "Overall Network Error:\t\t" + std::to_string(error),
+            "Correctly recognised digits:\t" + std::to_string((int)percent) + "%  (" + std::to_string(recognized) + " / " + std::to_string(samples) + ")"
+        };
+        std::string summary;
+        for (const auto& line : lines) {
+            summary += line.substr(0, REPORT_SUMMARY_WIDTH) + std::string(REPORT_SUMMARY_WIDTH - std::min<ulong>(line.size(), REPORT_SUMMARY_WIDTH), ' ') + "\n";
+        }
+        return summary;
+    }
+};
+
+
+// label,prediction,score0,...,score9 per digit
+class NetCsvReport : public NetReport {
+public:
+    NetCsvReport(const std::string& path) : NetReport(path) {
+        _sink.Write("label,prediction");
+        for (long i = 0; i < MNIST_CLASSES; i++) { _sink.Print(",score%ld", i); }
+        _sink.Write('\n');
+    }
+
+    void Consume(const MNISTchar& t, const double* result) override {
+        _sink.Print("%d,%ld", t.label, (long)(std::max_element(result, result + MNIST_CLASSES) - result));
+        for (long i = 0; i < MNIST_CLASSES; i++) { _sink.Print(",%.9g", result[i]); }
+        _sink.Write('\n');
+    }
+};
+
+
+// NetResultHeader + one NetResultRecord per digit (the record count follows from the file size)
+class NetBinaryReport : public NetReport {
+public:
+    NetBinaryReport(const std::string& path) : NetReport(path) {
+        NetResultHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, RESULT_MAGIC, sizeof(header.magic));
+        header.classes = MNIST_CLASSES;
+        header.recordBytes = sizeof(NetResultRecord);
+        _sink.Write(&header, sizeof(header));
+    }
+
+    void Consume(const MNISTchar& t, const double* result) override {
+        NetResultRecord record;
+        memset(&record, 0, sizeof(record));
+        record.label = (uint8_t)t.label;
+        record.prediction = (uint8_t)(std::max_element(result, result + MNIST_CLASSES) - result);
+        for (long i = 0; i < MNIST_CLASSES; i++) { record.scores[i] = (float)result[i]; }
+        _sink.Write(&record, sizeof(record));
+    }
+};
+
+
+// Open a report of the given format, returns nullptr if the file can not be created
+std::unique_ptr<NetReport> CreateNetReport(ReportFormat format, const std::string& path) {
+    std::unique_ptr<NetReport> report;
+    switch (format) {
+        case ReportFormat::CSV:    report.reset(new NetCsvReport(path)); break;
+        case ReportFormat::Binary: report.reset(new NetBinaryReport(path)); break;
+        default:                   report.reset(new NetTextReport(path)); break;
+    }
+    if (!report->isOpen()) {
+        std::cout <<"ERROR: writing the test results " <<path <<std::endl;
+        return nullptr;
+    }
+    return report;
+}
@@ -32,20 +32,37 @@
 #pragma once
 
 #include "Neuron.h"
+#include "../NetActivation.h"
 
 enum class LayerType {Input, Hidden, Output};
 
+// Every Layer stores the connections of its Neurons to the next Layer in two contiguous matrices
+// (structure of arrays): weights and deltaWeights (momentum), one row per Neuron of the next Layer
+// with the connections from all Neurons of this Layer (bias last). So the forward pass (a row
+// times the outputs), the gradients and the weight update all walk the memory with unit stride.
 class Layer {
 private:
     const LayerType type;
+    const Activation activation;                // Activation function of the Neurons (see NetActivation.h)
     std::vector<Neuron> neurons;
+    const ulong nextCount;                      // Neurons in the next Layer (- Bias)
+    std::vector<double> weights;                // nextCount x getNeuronCount()
+    std::vector<double> deltaWeights;           // nextCount x getNeuronCount()
+    std::vector<double> values;                 // Contiguous copy of the output values / gradients of a neighbour Layer
+    std::vector<double> outputValues;           // Contiguous copy of the own output values (activation functions)
     
 public:
-    Layer(ulong nCount, ulong nCountNext, LayerType ltype) : type(ltype) {
-        for(ulong i = 0; i < nCount; i++) { neurons.push_back(Neuron(nCountNext, i)); }
+    Layer(ulong nCount, ulong nCountNext, LayerType ltype) : type(ltype), activation(layerActivation(ltype)), nextCount(nCountNext) {
+        for(ulong i = 0; i < nCount; i++) { neurons.push_back(Neuron(i)); }
         // Add one Bias Neuron to the Layer and set the output value to 1.0
-        neurons.push_back(Neuron(nCountNext, neurons.size()));
+        neurons.push_back(Neuron(neurons.size()));
         neurons.back().outputValue = 1.0f;
+        // Random start weights (drawn Neuron by Neuron), no delta weights
+        weights = std::vector<double>(nextCount * neurons.size());
+        deltaWeights = std::vector<double>(nextCount * neurons.size(), 0.0);
+        for(ulong n = 0; n < neurons.size(); n++) {
+            for(ulong j = 0; j < nextCount; j++) { weights[j * neurons.size() + n] = random_0_1; }
+        }
     }
     
     
@@ -61,26 +78,38 @@ public:
     
     
     void feedForward(const Layer& prev) {
+        // The outputs of the previous Layer (with the Bias Neuron) in one contiguous vector
+        const ulong inputs = prev.getNeuronCount();
+        gatherOutputValues(prev);
         // Forward Propagate the inputValues throug each Neuron of the Layer (- Bias)
-        for(ulong i = 0; i < this->getNeuronCountNoBias(); i++) {
-            const ulong index = this->neurons[i].index;
+        const ulong count = this->getNeuronCountNoBias();
+        this->outputValues.resize(count);
+        for(ulong i = 0; i < count; i++) {
+            const double* w = prev.getWeightRow(this->neurons[i].index);
             double sum = 0.0f;
             // Sum up all Outputs from the previous Layer (with the Bias Neuron)
-            for(const Neuron& n : prev.getNeurons()) { sum += (n.outputValue * n.outputWeights[index].weight); }
-            // Apply the sigmoid function to shape the output value (curve between 0.0 and 1.0)
-            this->neurons[i].outputValue = sigmoidFunction(sum);
+            for(ulong n = 0; n < inputs; n++) { sum += (this->values[n] * w[n]); }
+            this->outputValues[i] = sum;
         }
+        // Apply the activation function to shape the output values (e.g. sigmoid: curve between 0.0 and 1.0)
+        Activate(this->activation, this->outputValues.data(), count, 1);
+        for(ulong i = 0; i < count; i++) { this->neurons[i].outputValue = this->outputValues[i]; }
     }
     
     
     // Calculate the new Gradients of the Output-Layer Neurons
     void calculateGradients(const std::vector<double>& expOutputs) {
         if(this->type == LayerType::Output) {
-            for(ulong i = 0; i < this->getNeuronCountNoBias(); i++) {
-                const double outputVal = this->neurons[i].outputValue;
-                const double delta = expOutputs[i] - outputVal;
-                this->neurons[i].gradient = delta * gradientFunction(outputVal);
+            // Delta times the activation derivative, from the output values (Softmax: the whole Jacobian)
+            const ulong count = this->getNeuronCountNoBias();
+            this->values.resize(count);
+            this->outputValues.resize(count);
+            for(ulong i = 0; i < count; i++) {
+                this->outputValues[i] = this->neurons[i].outputValue;
+                this->values[i] = expOutputs[i] - this->outputValues[i];
             }
+            ActivationBackward(this->activation, this->values.data(), this->outputValues.data(), count, 1);
+            for(ulong i = 0; i < count; i++) { this->neurons[i].gradient = this->values[i]; }
         } else { std::cout <<"ERROR: Trying to calculate OutputGradients on a non Output-Layer" <<std::endl; }
     }
     
@@ -88,31 +117,38 @@ public:
     // Calculate the new Gradients of the Hidden-Layer Neurons
     void calculateGradients(const Layer& next) {
         if(this->type == LayerType::Hidden) {
-            for(ulong i = 0; i < this->getNeuronCount(); i++) {
-                const double outputVal = this->neurons[i].outputValue;
-                double dow = 0.0f;
-                // Sum up all contributions of the errors, to the Neurons in the next Layer
-                for(ulong j = 0; j < next.getNeuronCountNoBias(); j++) {
-                    dow += (this->neurons[i].outputWeights[j].weight * next.getNeuron(j).gradient);
-                }
-                this->neurons[i].gradient = dow * gradientFunction(outputVal);
+            const ulong count = this->getNeuronCount();
+            // Sum up all contributions of the errors, to the Neurons in the next Layer
+            // (row by row: dow[i] += weight(i -> j) * gradient(j), in the order of j)
+            this->values.assign(count, 0.0);
+            for(ulong j = 0; j < next.getNeuronCountNoBias(); j++) {
+                const double* w = this->getWeightRow(j);
+                const double nextGradient = next.getNeuron(j).gradient;
+                for(ulong i = 0; i < count; i++) { this->values[i] += (w[i] * nextGradient); }
+            }
+            for(ulong i = 0; i < count; i++) {
+                this->neurons[i].gradient = this->values[i] * ActivationPrime(this->activation, this->neurons[i].outputValue);
             }
         } else { std::cout <<"ERROR: Trying to calculate HiddenGradients on a non Hidden-Layer" <<std::endl; }
     }
     
     
-    void updateWeights(Layer& prev) const {
+    void updateWeights(Layer& prev) {
+        const ulong inputs = prev.getNeuronCount();
+        gatherOutputValues(prev);
         for (ulong n = 0; n < this->getNeuronCountNoBias(); n++) {
-            const auto tmpInd = this->neurons[n].index;
+            const ulong row = this->neurons[n].index;
+            const double gradient = this->neurons[n].gradient;
+            double* w = prev.weights.data() + row * inputs;
+            double* dw = prev.deltaWeights.data() + row * inputs;
             // Loop throug all the neruons in the previous layer, because each
             // has a weighted connection to the current neuron that needs to be updated
-            for (Neuron& prevNeuron : prev.getNeurons()) {
-                const auto oldDeltaWeight = prevNeuron.outputWeights[tmpInd].deltaWeight;
+            for (ulong p = 0; p < inputs; p++) {
                 // The new weight is magnified by the gradient, the learning rate (ETA),
                 // and also the added momentum (ALPHA): a fraction of the previous delta weight
-                const auto newDeltaWeight = (ETA * prevNeuron.outputValue * this->neurons[n].gradient) + (ALPHA * oldDeltaWeight);
-                prevNeuron.outputWeights[tmpInd].deltaWeight = newDeltaWeight;
-                prevNeuron.outputWeights[tmpInd].weight += newDeltaWeight;
+                const double newDeltaWeight = (ETA * this->values[p] * gradient) + (ALPHA * dw[p]);
+                dw[p] = newDeltaWeight;
+                w[p] += newDeltaWeight;
             }
         }
     }
@@ -149,20 +185,49 @@ public:
         return tmpres;
     }
     
+    // (Without allocating: "results" has to hold getNeuronCountNoBias() values)
+    void getResults(double* results) const {
+        for(ulong i = 0; i < this->getNeuronCountNoBias(); i++) { results[i] = this->neurons[i].outputValue; }
+    }
+    
     
     // GETTER - SETTER
+    inline Activation getActivation() const { return this->activation; }
     inline size_t getNeuronCount() const { return  this->neurons.size(); }
     inline size_t getNeuronCountNoBias() const { return  (this->neurons.size() - 1); }
     inline const std::vector<Neuron>& getNeurons() const { return this->neurons; }
     inline std::vector<Neuron>& getNeurons() { return this->neurons; }
     inline const Neuron& getNeuron(ulong index) const { return this->neurons[index]; }
+    // Connection from Neuron "neuron" of this Layer to Neuron "next" of the next Layer
+    inline Connection getConnection(ulong neuron, ulong next) const {
+        const ulong i = next * this->neurons.size() + neuron;
+        return Connection(this->weights[i], this->deltaWeights[i]);
+    }
+    inline void setConnection(ulong neuron, ulong next, const Connection& connection) {
+        const ulong i = next * this->neurons.size() + neuron;
+        this->weights[i] = connection.weight;
+        this->deltaWeights[i] = connection.deltaWeight;
+    }
+    // The weights of all connections into Neuron "next" of the next Layer (getNeuronCount() values, bias last)
+    inline const double* getWeightRow(ulong next) const { return this->weights.data() + next * this->neurons.size(); }
+    inline double* getWeightRow(ulong next) { return this->weights.data() + next * this->neurons.size(); }
+    inline const double* getDeltaWeightRow(ulong next) const { return this->deltaWeights.data() + next * this->neurons.size(); }
+    inline double* getDeltaWeightRow(ulong next) { return this->deltaWeights.data() + next * this->neurons.size(); }
     
 private:
-    // The Sigmoid Function (having an S shaped curve) produces a output value between 0.0 and 1.0
-    // Definition:  s(t) = 1 / 1 + e^-t
-    inline double sigmoidFunction(double sum) const { return  (1.0f / (1.0f + exp(sum * -1.0f))); }
+    inline void gatherOutputValues(const Layer& layer) {
+        this->values.resize(layer.getNeuronCount());
+        for(ulong n = 0; n < layer.getNeuronCount(); n++) { this->values[n] = layer.getNeuron(n).outputValue; }
+    }
     
-    // OLD "transferFunctionDerivative": return (1.0 - (sum * sum));
-    inline double gradientFunction(double sum) const { return (exp(sum * -1.0f) / pow(exp(sum * -1.0f) + 1.0f, 2.0f)); }
+    // Hidden Layers use HIDDEN_ACTIVATION, the Output Layer OUTPUT_ACTIVATION (Softmax only fits the Output Layer)
+    static Activation layerActivation(LayerType ltype) {
+        if(ltype == LayerType::Output) { return OUTPUT_ACTIVATION; }
+        if(HIDDEN_ACTIVATION == Activation::Softmax) {
+            std::cout <<"ERROR: Softmax is only supported on the Output-Layer, the Hidden-Layers use the sigmoid function" <<std::endl;
+            return Activation::Sigmoid;
+        }
+        return HIDDEN_ACTIVATION;
+    }
     
 };
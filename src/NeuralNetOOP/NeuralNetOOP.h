@@ -32,6 +32,11 @@
 #pragma once
 
 #include "MNIST.h"
+#include "NetModel.h"
+#include "NetReport.h"
+#include "NetMetrics.h"
+#include "NetPipeline.h"
+#include "NetCheckpoint.h"
 #include "Layer.h"
 
 class NeuralNetOOP {
@@ -39,9 +44,19 @@ private:
     double netError;
     double recentAverageError;
     std::vector<Layer> layers;
+    NetMetrics* metrics;                    // Training instrumentation (not owned, see NetMetrics.h)
+    // Checkpoints of train (see NetCheckpoint.h) and the position a resumed run continues at
+    std::unique_ptr<NetCheckpointWriter<double>> checkpoints;
+    long checkpointInterval;
+    ulong shuffleSeed;
+    bool resumed;
+    long resumeEpoch;
+    ulong resumeSample;
     
 public:
-    NeuralNetOOP(const Topology& topology) : netError(0.0), recentAverageError(0.0) {
+    NeuralNetOOP(const Topology& topology)
+    : netError(0.0), recentAverageError(0.0), metrics(nullptr), checkpointInterval(CHECKPOINT_INTERVAL), shuffleSeed(0),
+      resumed(false), resumeEpoch(0), resumeSample(0) {
         // Network needs at least 2 Layers (1 Input & 1 Output)
         if(topology.size() >= 2) {
             // Create every Layer in the Net (1 Input, X Hidden, 1 Output)
@@ -56,19 +71,60 @@ public:
     }
     
     
+    // Report the training phases, samples and loss to "metrics" (nullptr = off)
+    void setMetrics(NetMetrics* metrics) { this->metrics = metrics; }
+    
+    
     // Train the NeuralNet by feeding forward all the input data
     // and then backpropagating with the according output data
+    // (one digit at a time from a NetPipeline, shuffled every iteration with SHUFFLE_SAMPLES)
     void train(const MNIST& mnist) {
-        for(int i = 0; i < TRAINING_ITER; i++) {
-            for(const MNISTchar& mc : mnist.trainingData) {
-                feedForward(mc.pixelData);
-                backPropagate(mc.output);
-            }
+        if(!this->resumed) { this->shuffleSeed = SHUFFLE_SAMPLES ? rand() : 0; }
+        NetPipeline<double> pipeline(mnist.trainingData, 1, TRAINING_ITER, SHUFFLE_SAMPLES, this->shuffleSeed,
+                                     this->resumed ? this->resumeEpoch : 0, this->resumed ? this->resumeSample : 0);
+        this->resumed = false;
+        NetThreadCounters* counters = getCounters();
+        long sinceCheckpoint = 0;
+        for(;;) {
+            NetPhaseTimer fetch(counters, NetPhase::Fetch);
+            const NetBatch<double>* digit = pipeline.Next();
+            fetch.Stop();
+            if(digit == nullptr) { break; }
+            NetPhaseTimer forward(counters, NetPhase::Forward);
+            feedForward(digit->input);
+            forward.Stop();
+            backPropagate(digit->expectedOutput);
+            // (A skipped checkpoint is taken after the next digit)
+            if(this->checkpoints && ++sinceCheckpoint >= this->checkpointInterval
+               && checkpoint(digit->epoch, digit->first + 1, mnist.trainingData.size())) { sinceCheckpoint = 0; }
         }
+        if(this->checkpoints) { this->checkpoints->Flush(); }
+    }
+    
+    
+    // Write a checkpoint every "interval" digits of train (on a background thread, see NetCheckpoint.h), "" = no checkpoints
+    void setCheckpoints(const std::string& checkpointPath, long interval = CHECKPOINT_INTERVAL) {
+        this->checkpoints.reset(checkpointPath.empty() ? nullptr : new NetCheckpointWriter<double>(checkpointPath));
+        this->checkpointInterval = std::max<long>(1, interval);
+    }
+    
+    
+    // Continue an interrupted run from a checkpoint: The net gets the weights and delta weights of the
+    // checkpoint, and the next call of train skips the digits the run had trained already
+    bool resume(const std::string& checkpointPath) {
+        NetTrainingState state;
+        if(!ReadTrainingState(checkpointPath, state) || !importNeuralNet(checkpointPath)) { return false; }
+        this->recentAverageError = state.recentAverageError;
+        this->shuffleSeed = state.seed;
+        this->resumed = true;
+        this->resumeEpoch = state.epoch;
+        this->resumeSample = state.sample;
+        return true;
     }
 
     
-private:
+    // One training step: feed a sample forward and backpropagate its expected output
+    // (public for the step benchmarks, "train" runs them over the whole training data)
     void feedForward(const std::vector<double>& inputValues) {
         // Pass the input values to the input Layer
         this->layers.front().setInputValues(inputValues);
@@ -81,6 +137,9 @@ private:
         // Get the overall net error and calculate the recent average measurement
         this->netError = this->layers.back().getError(expOutputs);
         this->recentAverageError = (recentAverageError * SMOOTHING_FACTOR + netError) / (SMOOTHING_FACTOR + 1.0);
+        NetThreadCounters* counters = getCounters();
+        if(counters != nullptr) { counters->AddSamples(1, netError * netError); }
+        NetPhaseTimer backward(counters, NetPhase::Backward);
         // Gradients: While training the net, gradients will push the Neuron outputs
         // in a direction that will reduce the overall error value
         // Calculate output layer gradients
@@ -88,6 +147,8 @@ private:
         // Calcualte hidden layer gradients
         // (Loop backwards from the penultimate Layer to the second layer ... through all hidden Layers)
         for (ulong i = (this->layers.size() - 2); i > 0; i--) { this->layers[i].calculateGradients(this->layers[i+1]); }
+        backward.Stop();
+        NetPhaseTimer update(counters, NetPhase::Update);
         // Update the connection weights
         // (Loop from the output Layer backwards to the first hidden layer / Input Layer has no in coming weights)
         for (ulong i = (layers.size() - 1); i > 0; i--) { this->layers[i].updateWeights(this->layers[i-1]); }
@@ -95,68 +156,155 @@ private:
     
     
 public:
-    void exportNeuralNet(const std::string& exportPath) const { }
-    void importNeuralNet(const std::string& importPath) { }
-    
-    
-    // Feed the test data to the net and write all results to a file
-    void test(MNIST& mnist, const std::string& resultsPath) {
-        double errSum = 0.0f;
-        int recognizeCount = 0;
-        std::vector<std::string> outputStrings = std::vector<std::string>();
-        // Add some general output with the overall error values
-        outputStrings.push_back("Overall Network Error:\t\t");
-        outputStrings.push_back("Correctly recognised digits:\t");
-        outputStrings.push_back("\n\nTest Data Digits:\n");
-        // Add some output for ever Digit in the testData
-        for(const auto& t : mnist.testData) {
-            outputStrings.push_back("----------------------------------");
-            // feed forward the testData
-            feedForward(t.pixelData);
-            // get the Neural Nets results
-            errSum += this->netError;
-            const auto result = this->layers.back().getResults();
-            // generate the current test digit as an ASCII picture
-            auto asciiDigit = mnist.MNISTcharToASCII(t);
-            outputStrings.insert(outputStrings.end(), asciiDigit.begin(), asciiDigit.end());
-            // generate the exprected / actual results table
-            outputStrings.push_back("\n");
-            for(ulong i = 0; i < t.output.size(); i++) {
-                outputStrings.push_back(std::to_string((int)t.output[i]) + "\t\t\t" + std::to_string((double)result[i]));
+    // Export / import the connection weights in the model format shared with NeuralNetVec (see NetModel.h):
+    // The weight rows of layer i (without the bias column) are W[i], the bias neuron weights are B[i],
+    // and the delta weights are stored as the momentum state
+    void exportNeuralNet(const std::string& exportPath) const {
+        NetCheckpointData<double> model;
+        getModel(model);
+        WriteNetModel(exportPath, model.layers, model.learningRate, model.optimizer, model.weights, model.biases, model.slotWeights,
+                      model.slotBiases, model.optimizerStep, model.hiddenActivation, model.outputActivation);
+    }
+    
+    
+    bool importNeuralNet(const std::string& importPath) {
+        const NetModel model(importPath);
+        if(!model.isValid()) { return false; }
+        const Topology topology = getTopology();
+        if(model.layers() != topology) {
+            std::cout <<"ERROR: The topology of " <<importPath <<" does not match the Network" <<std::endl;
+            return false;
+        }
+        if(model.outputActivation() != getOutputActivation() || (topology.size() > 2 && model.hiddenActivation() != getHiddenActivation())) {
+            std::cout <<"ERROR: The activation functions of " <<importPath <<" do not match the Network" <<std::endl;
+            return false;
+        }
+        // Models without momentum state (e.g. from NeuralNetVec) start with zero delta weights
+        const bool momentum = (model.optimizer() == ModelOptimizer::Momentum && model.optimizerSlots() == 1);
+        for(ulong i = 0; i < topology.size() - 1; i++) {
+            const ulong rows = topology[i + 1], columns = topology[i];
+            Matrix weights(rows * columns), deltaWeights(rows * columns, 0.0);
+            Vector biases(rows), deltaBiases(rows, 0.0);
+            model.copyWeights(i, weights.data());
+            model.copyBiases(i, biases.data());
+            if(momentum) {
+                model.copySlotWeights(0, i, deltaWeights.data());
+                model.copySlotBiases(0, i, deltaBiases.data());
             }
-            // generate the networks guess
-            outputStrings.push_back("\n");
-            ulong num = -1, count = 0;
-            std::string tmp = "";
-            // get the Number with the highest possibility ( >= 0.8 )
-            // and check if the other are as low as expected ( <= 0.2 )
-            for(ulong i = 0; i < result.size(); i++) {
-                if(result[i] >= 0.8f) { num = i; }
-                if(result[i] <= 0.2f) { count++; }
+            Layer& layer = this->layers[i];
+            for(ulong r = 0; r < rows; r++) {
+                std::copy(weights.begin() + r * columns, weights.begin() + (r + 1) * columns, layer.getWeightRow(r));
+                std::copy(deltaWeights.begin() + r * columns, deltaWeights.begin() + (r + 1) * columns, layer.getDeltaWeightRow(r));
+                layer.getWeightRow(r)[columns] = biases[r];
+                layer.getDeltaWeightRow(r)[columns] = deltaBiases[r];
             }
-            tmp += (count >= 9) ? " definitely a: " : " very likely a: ";
-            tmp += "\t" + std::to_string(num);
-            outputStrings.push_back("This is" + tmp);
-            // Check if the estimated digit is correct
-            if(num == t.label) {
-                recognizeCount++;
-                outputStrings.push_back("Network guessed:\tCORRECT");
-            } else {
-                outputStrings.push_back("Network guessed:\tWRONG");
+        }
+        return true;
+    }
+    
+    
+    // Neurons per layer (without the bias neurons)
+    Topology getTopology() const {
+        Topology topology;
+        for(const Layer& l : this->layers) { topology.push_back(l.getNeuronCountNoBias()); }
+        return topology;
+    }
+    
+    
+    // RMS error of the last backpropagated sample and its running average (over SMOOTHING_FACTOR samples)
+    double getNetError() const { return this->netError; }
+    double getRecentAverageError() const { return this->recentAverageError; }
+    
+    
+    // Activation functions of the Hidden-Layers (sigmoid for a Network without Hidden-Layers) and the Output-Layer
+    Activation getHiddenActivation() const { return (this->layers.size() > 2) ? this->layers[1].getActivation() : Activation::Sigmoid; }
+    Activation getOutputActivation() const { return this->layers.back().getActivation(); }
+    
+    
+    // Score the net on a data set (one digit at a time), the optional consumer gets the outputs of every digit
+    NetEvaluation evaluate(const MNISTset& data, long topK = EVALUATION_TOP_K, NetResultConsumer* consumer = nullptr) {
+        NetEvaluation evaluation(topK);
+        if(this->layers.empty() || data.imageSize() != this->layers.front().getNeuronCountNoBias()
+           || this->layers.back().getNeuronCountNoBias() != MNIST_CLASSES) {
+            std::cout <<"ERROR: " <<data.imageSize() <<" pixel digits do not fit the net topology" <<std::endl;
+            return evaluation.Finish();
+        }
+        std::vector<double> input(data.imageSize());
+        std::vector<double> output(MNIST_CLASSES);
+        for(const auto t : data) {
+            t.normalizedPixels(input.data());
+            feedForward(input);
+            this->layers.back().getResults(output.data());
+            evaluation.Add(output.data(), t.label);
+            if(consumer != nullptr) { consumer->Consume(t, output.data()); }
+        }
+        return evaluation.Finish();
+    }
+    
+    
+    // Feed the test data to the net and write all results to a file (streamed while the digits are evaluated)
+    void test(MNIST& mnist, const std::string& resultsPath, ReportFormat format = ReportFormat::Text) {
+        std::unique_ptr<NetReport> report = CreateNetReport(format, resultsPath);
+        if (report) { report->Finish(evaluate(mnist.testData, EVALUATION_TOP_K, report.get())); }
+    }
+    
+    
+private:
+    // The model of the net (the delta weights as the momentum state, see exportNeuralNet), reuses the buffers of "model"
+    void getModel(NetCheckpointData<double>& model) const {
+        const Topology topology = getTopology();
+        model.layers = topology;
+        model.learningRate = ETA;
+        model.optimizer = ModelOptimizer::Momentum;
+        model.optimizerStep = 0;
+        model.hiddenActivation = getHiddenActivation();
+        model.outputActivation = getOutputActivation();
+        model.weights.resize(topology.size() - 1);
+        model.biases.resize(topology.size() - 1);
+        model.slotWeights.resize(1, std::vector<Matrix>(topology.size() - 1));
+        model.slotBiases.resize(1, std::vector<Vector>(topology.size() - 1));
+        for(ulong i = 0; i < topology.size() - 1; i++) {
+            const ulong rows = topology[i + 1], columns = topology[i];
+            Matrix& weights = model.weights[i];
+            Matrix& deltaWeights = model.slotWeights[0][i];
+            weights.resize(rows * columns);
+            deltaWeights.resize(rows * columns);
+            model.biases[i].resize(rows);
+            model.slotBiases[0][i].resize(rows);
+            const Layer& layer = this->layers[i];
+            for(ulong r = 0; r < rows; r++) {
+                std::copy(layer.getWeightRow(r), layer.getWeightRow(r) + columns, weights.begin() + r * columns);
+                std::copy(layer.getDeltaWeightRow(r), layer.getDeltaWeightRow(r) + columns, deltaWeights.begin() + r * columns);
+                model.biases[i][r] = layer.getWeightRow(r)[columns];
+                model.slotBiases[0][i][r] = layer.getDeltaWeightRow(r)[columns];
             }
-            outputStrings.push_back("----------------------------------");
         }
-        // Calculate the overall Error
-        errSum = (errSum / mnist.testData.size());
-        outputStrings[0] += std::to_string(errSum);
-        // Calculate percentage of correctly recognized digits
-        double percent = ((double)recognizeCount / mnist.testData.size()) * 100.0f;
-        outputStrings[1] += (std::to_string((int)percent) + "%  (" + std::to_string(recognizeCount)
-                                    + " / " + std::to_string(mnist.testData.size()) + ")");
-        // WRITE ALL THE TEST OUTPUTS TO A FILE
-        std::fstream file (resultsPath, std::ifstream::out | std::ifstream::binary);
-        if (file.is_open()) { for(const auto& line : outputStrings) { file << line + "\n"; } }
-        file.close();
     }
     
+    
+    // Copy the net into the next checkpoint buffer (false if the writer is still busy with it)
+    // "epoch" / "next" = position of the next digit
+    bool checkpoint(long epoch, ulong next, ulong epochSize) {
+        NetCheckpointData<double>* checkpoint = this->checkpoints->Acquire();
+        if(checkpoint == nullptr) { return false; }
+        if(next >= epochSize) {
+            epoch++;
+            next = 0;
+        }
+        getModel(*checkpoint);
+        NetTrainingState& state = checkpoint->state;
+        state.seed = this->shuffleSeed;
+        state.epoch = epoch;
+        state.sample = next;
+        state.batchSize = 1;
+        state.recentAverageError = this->recentAverageError;
+        state.momentum = ALPHA;
+        this->checkpoints->Submit();
+        return true;
+    }
+    
+    
+    // Always nullptr without NET_METRICS (so the timers compile away), the net trains on one thread
+    NetThreadCounters* getCounters() const { return (NET_METRICS && this->metrics != nullptr) ? this->metrics->Thread(0) : nullptr; }
+    
 };
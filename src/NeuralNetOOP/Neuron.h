@@ -33,13 +33,13 @@
 
 #include "../NetBase.h"
 
-// Weight and DeltaWeight for each connection of the
-// Neuron, to the Neurons in the next Layer
+// Weight and DeltaWeight of one connection from a Neuron to a Neuron in the next Layer
+// (The Layer stores them in contiguous weight / delta weight matrices, see Layer.h)
 struct Connection {
     double weight;
     double deltaWeight;
     
-    Connection() : weight(random_0_1), deltaWeight(0.0f) { }
+    Connection(double w, double dw) : weight(w), deltaWeight(dw) { }
 };
 
 // Simple Sigmoid Neuron
@@ -47,8 +47,6 @@ struct Neuron {
     const ulong index;                          // Index of the Neuron in it's Layer
     double outputValue;                         // Value of the Neuron given to all Neurons in the next Layer
     double gradient;                            // used by the backpropagation
-    std::vector<Connection> outputWeights;      // Output weight values for all connected Neurons in the next Layer
     
-    // Fully connected Net: One Connection for each Neuron in the next Layer
-    Neuron(ulong outputs, ulong ind) : index(ind), outputValue(0.0f), gradient(0.0f), outputWeights(outputs) { }
+    Neuron(ulong ind) : index(ind), outputValue(0.0f), gradient(0.0f) { }
 };
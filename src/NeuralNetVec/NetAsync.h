@@ -0,0 +1,136 @@
+//  NetAsync.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <memory>
+
+#include "NetMath.h"
+
+// Asynchronous (Hogwild!) training: Every thread feeds forward and backpropagates its own
+// samples against the shared weights and writes its updates straight back, without waiting
+// for the other threads. The variants only differ in how a weight update is protected:
+//   Atomic:    relaxed atomic load / store per weight, no locks at all. Updates of two threads
+//              to the same weight can overwrite each other (the Hogwild! trade-off)
+//   RowLocks:  striped mutexes, one per group of weight rows (neurons), held while a row is updated
+//   Mutex:     one reader / writer lock: the forward and backward passes of a batch hold it shared,
+//              the complete weight update of a batch holds it exclusively (the only fully synchronized mode)
+// With Atomic and RowLocks the forward and backward passes read the weights without any synchronization,
+// while the other threads write them (racy reads, as in Hogwild!: a read may see a weight half way updated).
+
+#define ASYNC_LOCK_STRIPES          64                          // Mutexes shared by all weight rows (RowLocks)
+
+enum class AsyncUpdate { Atomic, RowLocks, Mutex };
+
+const char* AsyncUpdateName(AsyncUpdate mode) {
+    switch (mode) {
+        case AsyncUpdate::Atomic:   return "Atomic";
+        case AsyncUpdate::RowLocks: return "RowLocks";
+        case AsyncUpdate::Mutex:    return "Mutex";
+    }
+    return "";
+}
+
+// The weights stay plain floats / doubles, the lock-free variant accesses them with the atomic builtins
+// (no std::atomic<T> view of the plain storage). Without the builtins: volatile loads / stores (MSVC)
+template<typename T>
+inline T LoadRelaxed(const T* value) {
+#if defined(__GNUC__) || defined(__clang__)
+    T result;
+    __atomic_load(value, &result, __ATOMIC_RELAXED);
+    return result;
+#else
+    return *(const volatile T*)value;
+#endif
+}
+
+template<typename T>
+inline void StoreRelaxed(T* value, T newValue) {
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store(value, &newValue, __ATOMIC_RELAXED);
+#else
+    *(volatile T*)value = newValue;
+#endif
+}
+
+
+// Locks shared by all the training threads
+struct AsyncLocks {
+    std::shared_timed_mutex coarse;
+    std::unique_ptr<std::mutex[]> stripes;
+
+    AsyncLocks() : stripes(new std::mutex[ASYNC_LOCK_STRIPES]) { }
+
+    inline std::mutex& Row(long layer, long row) { return stripes[(layer * 7919 + row) % ASYNC_LOCK_STRIPES]; }
+};
+
+
+// row += scale * neurons (relaxed atomic loads and stores, no read-modify-write protection)
+template<typename T>
+void AxpyRelaxed(T scale, const T* neurons, T* row, long columns) {
+    for (long c = 0; c < columns; c++) {
+        StoreRelaxed(row + c, LoadRelaxed(row + c) + (scale * neurons[c]));
+    }
+}
+
+
+// W -= learnRate * dEdB.transpose().dot(H) / batchSize  and  B -= learnRate * mean(dEdB)
+// for one layer of a worker batch, written to the shared weights with the chosen protection
+template<typename T>
+void UpdateLayerAsync(std::vector<T>& weight, std::vector<T>& bias, const std::vector<T>& neurons, const std::vector<T>& biasDelta, const long rows, const long columns,
+                      const long batchSize, const double learnRate, const long layer, const AsyncUpdate mode, AsyncLocks& locks) {
+    const SimdKernelsT<T>& simd = Simd<T>();
+    for (long row = 0; row < rows; row++) {
+        T* weightRow = weight.data() + row * columns;
+        T biasStep = 0;
+        if (mode == AsyncUpdate::Atomic) {
+            for (long b = 0; b < batchSize; b++) {
+                const T scale = (T)(-learnRate) * biasDelta[b * rows + row] / batchSize;
+                AxpyRelaxed(scale, neurons.data() + b * columns, weightRow, columns);
+                biasStep += scale;
+            }
+            StoreRelaxed(&bias[row], LoadRelaxed(&bias[row]) + biasStep);
+            continue;
+        }
+        // RowLocks: lock the stripe of this row / Mutex: the caller holds the coarse lock
+        std::unique_lock<std::mutex> lock;
+        if (mode == AsyncUpdate::RowLocks) { lock = std::unique_lock<std::mutex>(locks.Row(layer, row)); }
+        for (long b = 0; b < batchSize; b++) {
+            const T scale = (T)(-learnRate) * biasDelta[b * rows + row] / batchSize;
+            simd.Axpy(scale, neurons.data() + b * columns, weightRow, columns);
+            biasStep += scale;
+        }
+        bias[row] += biasStep;
+    }
+}
@@ -0,0 +1,131 @@
+//  NetEarlyStopping.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <thread>
+
+#include "NeuralNetVec.h"
+
+// Training schedule of NeuralNetVec with early stopping: The last VALIDATION_SHARE of the training
+// data is held out, the net trains on the rest one iteration (epoch) at a time. After every iteration
+// a Snapshot of the weights is scored on the validation digits on a background thread, while the
+// next iteration trains (so every decision lags one iteration behind). When the validation accuracy
+// did not improve for EARLY_STOP_PATIENCE evaluations, the learning rate is cut (up to
+// LEARNING_RATE_CUTS times), after that training stops. In the end the net gets the best weights back.
+
+#define VALIDATION_SHARE            0.1                         // Share of the training digits held out for validation
+#define EARLY_STOP_PATIENCE         2                           // Evaluations without improvement before the learning rate is cut / training stops
+#define EARLY_STOP_MIN_DELTA        0.05                        // Accuracy gain (%) that counts as an improvement
+#define LEARNING_RATE_CUTS          1                           // Learning rate cuts on a plateau before training stops
+#define LEARNING_RATE_DECAY         0.5                         // Multiplier of a learning rate cut
+
+
+struct NetEarlyStoppingReport {
+    long iterations;                        // Trained iterations
+    long bestIteration;                     // Iteration of the returned weights (1 = after the first one)
+    double bestAccuracy;                    // Validation accuracy (%) of the returned weights
+    double learningRate;                    // Learning rate at the end
+    bool stoppedEarly;
+    std::vector<double> accuracies;         // Validation accuracy (%) after every iteration
+};
+
+
+template<typename T>
+class NetEarlyStopping {
+private:
+    const double _validationShare;
+    const long _patience;
+    const double _minDelta;
+    const long _learningRateCuts;
+    const double _learningRateDecay;
+    
+public:
+    NetEarlyStopping(double validationShare = VALIDATION_SHARE, long patience = EARLY_STOP_PATIENCE, double minDelta = EARLY_STOP_MIN_DELTA,
+                     long learningRateCuts = LEARNING_RATE_CUTS, double learningRateDecay = LEARNING_RATE_DECAY)
+    : _validationShare(validationShare), _patience(std::max<long>(1, patience)), _minDelta(minDelta),
+      _learningRateCuts(std::max<long>(0, learningRateCuts)), _learningRateDecay(learningRateDecay) { }
+    
+    
+    // Train "net" for at most "maxIterations" iterations over the training part of "data"
+    NetEarlyStoppingReport Train(NeuralNetVecT<T>& net, const MNISTset& data, long maxIterations) const {
+        NetEarlyStoppingReport report = { 0, 0, -1.0, net.learningRate(), false, {} };
+        const ulong validationCount = data.size() * _validationShare;
+        if (validationCount == 0 || validationCount >= data.size()) {
+            std::cout <<"ERROR: A validation share of " <<_validationShare <<" leaves no validation or training digits" <<std::endl;
+            return report;
+        }
+        const MNISTset training = data.slice(0, data.size() - validationCount);
+        const MNISTset validation = data.slice(data.size() - validationCount, validationCount);
+        
+        std::unique_ptr<NeuralNetVecT<T>> best = net.Snapshot();
+        std::unique_ptr<NeuralNetVecT<T>> evaluated;        // Snapshot that is scored on the background thread
+        std::thread evaluation;
+        double accuracy = 0.0;
+        long stale = 0, cuts = 0;
+        
+        // Apply the score of the last snapshot, false = stop training
+        auto decide = [&]() {
+            evaluation.join();
+            report.accuracies.push_back(accuracy);
+            if (accuracy > report.bestAccuracy + _minDelta) {
+                report.bestAccuracy = accuracy;
+                report.bestIteration = report.accuracies.size();
+                best = std::move(evaluated);
+                stale = 0;
+                return true;
+            }
+            if (++stale < _patience) { return true; }
+            if (cuts >= _learningRateCuts) { return false; }
+            cuts++;
+            stale = 0;
+            net.SetLearningRate(net.learningRate() * _learningRateDecay);
+            return true;
+        };
+        
+        for (long i = 0; i < maxIterations; i++) {
+            net.Train(1, training);
+            report.iterations++;
+            if (evaluation.joinable() && !decide()) {
+                report.stoppedEarly = true;
+                break;
+            }
+            evaluated = net.Snapshot();
+            NeuralNetVecT<T>* snapshot = evaluated.get();
+            evaluation = std::thread([&accuracy, &validation, snapshot]() { accuracy = snapshot->Evaluate(validation).accuracy; });
+        }
+        if (evaluation.joinable()) { decide(); }
+        
+        net.CopyWeights(*best);
+        report.learningRate = net.learningRate();
+        return report;
+    }
+};
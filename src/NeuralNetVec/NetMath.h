@@ -33,121 +33,403 @@
 
 #include <vector>
 #include <numeric>
+#include <algorithm>
 #include <math.h>
 
-#include "../NetBase.h"
+#include "NetSimd.h"
+#include "../NetActivation.h"
 
 
-Vector CalculateDotSigmoid(const Matrix& weights, const Vector& values, const Vector& bias, const long matRows) {
-    const long matColumns = values.size();
-    Vector result(matRows);
+// All functions are templates on the scalar type T (float or double) of the vectors / matrices.
+// All functions work on mini-batches: "values" holds batchSize input vectors back to back
+// (batchSize x columns, row-major) and the results hold batchSize output vectors.
+// A batchSize of 1 is the plain matrix-vector (stochastic / on-line) case.
+// The inner loops run on the SIMD kernels (NetSimd.h) selected for this CPU at runtime.
+//
+// Every kernel writes into a "result" output parameter that has to be large enough already
+// (see NetWorkspace.h), so the training step does not allocate. The buffers may be larger
+// than the current batch, that is why the dimensions are passed explicitly.
+// The returning versions at the end of the file are convenience wrappers around them.
+
+
+// result (batchSize x matRows) += weights (matRows x matColumns) DOT values (batchSize x matColumns)
+// Cache tiled over the weight matrix: each tile is loaded once and reused for all samples of the
+// batch, and inside a tile 4 weight rows at a time share every loaded value (register blocking)
+template<typename T>
+void CalculateDot(const T* weights, const T* values, T* result, const long matRows, const long matColumns, const long batchSize) {
+    const SimdKernelsT<T>& simd = Simd<T>();
     
-    for (long r = 0; r < matRows; r++) {
-        for (long c = 0; c < matColumns; c++) {
-            // Get the dot product (sum of multiplications)
-            // of the weight-matix and value-vector for each row
-            result[r] += (weights[r * matColumns + c] * values[c]);
+    for (long r0 = 0; r0 < matRows; r0 += SIMD_ROW_TILE) {
+        const long r1 = std::min<long>(r0 + SIMD_ROW_TILE, matRows);
+        for (long c0 = 0; c0 < matColumns; c0 += SIMD_COLUMN_TILE) {
+            const long tileColumns = std::min<long>(SIMD_COLUMN_TILE, matColumns - c0);
+            for (long b = 0; b < batchSize; b++) {
+                const T* x = values + b * matColumns + c0;
+                T* out = result + b * matRows;
+                long r = r0;
+                for (; r + 4 <= r1; r += 4) {
+                    simd.Dot4(weights + r * matColumns + c0, matColumns, x, tileColumns, out + r);
+                }
+                for (; r < r1; r++) {
+                    out[r] += simd.Dot(weights + r * matColumns + c0, x, tileColumns);
+                }
+            }
         }
-        // Calculate the sigmoid function f(x) = 1/(1 + e^-x) based on the sum and added bias
-        result[r] = 1 / (1 + exp(-(result[r] + bias[r])));
     }
-    
-    return result;
 }
 
 
-Vector CalculateDotSigmoidPrime(const Matrix& weights, const Vector& values, const Vector& bias, const long matRows) {
-    const long matColumns = values.size();
-    Vector result(matRows);
-    double tmp = 0.0f;
+// result (batchSize x matColumns) += values (batchSize x matRows) DOT weights (matRows x matColumns)
+// This is weights.transpose() DOT values, computed on the row-major weights without a transpose:
+// each sample adds up its weight rows scaled by the values (unit stride). Tiled over the columns,
+// so the result tile of the whole batch stays in the cache while the weight rows stream through
+template<typename T>
+void CalculateDotTransposed(const T* weights, const T* values, T* result, const long matRows, const long matColumns, const long batchSize) {
+    const SimdKernelsT<T>& simd = Simd<T>();
     
-    for (long r = 0; r < matRows; r++) {
-        for (long c = 0; c < matColumns; c++) {
-            // Get the dot product (sum of multiplications)
-            // of the weight-matix and value-vector for each row
-            result[r] += (weights[r * matColumns + c] * values[c]);
+    for (long c0 = 0; c0 < matColumns; c0 += SIMD_COLUMN_TILE) {
+        const long tileColumns = std::min<long>(SIMD_COLUMN_TILE, matColumns - c0);
+        long r = 0;
+        for (; r + 4 <= matRows; r += 4) {
+            for (long b = 0; b < batchSize; b++) {
+                simd.Axpy4(values + b * matRows + r, weights + r * matColumns + c0, matColumns, result + b * matColumns + c0, tileColumns);
+            }
+        }
+        for (; r < matRows; r++) {
+            for (long b = 0; b < batchSize; b++) {
+                simd.Axpy(values[b * matRows + r], weights + r * matColumns + c0, result + b * matColumns + c0, tileColumns);
+            }
         }
-        // Calculate the sigmoid prime function based on the sum and added bias
-        tmp = (result[r] + bias[r]);
-        result[r] = exp(-tmp) / (pow(1 + exp(-tmp), 2));
     }
+}
+
+
+// result = f(weights DOT values + bias) with the activation function f (see NetActivation.h)
+// (weights / bias as plain pointers, e.g. into a memory mapped model)
+template<typename T>
+void CalculateDotActivation(std::vector<T>& result, const T* weights, const std::vector<T>& values, const T* bias, const long matRows, const long matColumns,
+                            const long batchSize, const Activation activation) {
+    // Get the dot product (sum of multiplications) of the weight-matix and each value-vector
+    std::fill(result.begin(), result.begin() + matRows * batchSize, 0.0);
+    CalculateDot(weights, values.data(), result.data(), matRows, matColumns, batchSize);
     
-    return result;
+    for (long b = 0; b < batchSize; b++) {
+        for (long r = 0; r < matRows; r++) {
+            result[b * matRows + r] += bias[r];
+        }
+    }
+    // Apply the activation function to the sums of the whole batch at once (vectorized)
+    Activate(activation, result.data(), matRows, batchSize);
+}
+
+template<typename T>
+void CalculateDotSigmoid(std::vector<T>& result, const T* weights, const std::vector<T>& values, const T* bias, const long matRows, const long matColumns, const long batchSize) {
+    CalculateDotActivation(result, weights, values, bias, matRows, matColumns, batchSize, Activation::Sigmoid);
+}
+
+template<typename T>
+void CalculateDotSigmoid(std::vector<T>& result, const std::vector<T>& weights, const std::vector<T>& values, const std::vector<T>& bias, const long matRows, const long matColumns, const long batchSize) {
+    CalculateDotSigmoid(result, weights.data(), values, bias.data(), matRows, matColumns, batchSize);
+}
+
+
+// Sigmoid prime of weights DOT values + bias:  s'(x) = s(x) * (1 - s(x))  (from the sigmoid, without pow)
+template<typename T>
+void CalculateDotSigmoidPrime(std::vector<T>& result, const std::vector<T>& weights, const std::vector<T>& values, const std::vector<T>& bias, const long matRows, const long matColumns, const long batchSize) {
+    CalculateDotSigmoid(result, weights, values, bias, matRows, matColumns, batchSize);
+    CalculateSigmoidPrime(result, result, matRows * batchSize);
+}
+
+
+// Sigmoid prime from the cached sigmoid outputs of the forward pass:  s'(x) = s(x) * (1 - s(x))
+// (Same values as CalculateDotSigmoidPrime, without the second dot product)
+template<typename T>
+void CalculateSigmoidPrime(std::vector<T>& result, const std::vector<T>& sigmoidOutput, const long count) {
+    for (long i = 0; i < count; i++) {
+        result[i] = sigmoidOutput[i] * (1 - sigmoidOutput[i]);
+    }
+}
+
+
+// Activation prime from the cached outputs of the forward pass (element wise, not for Softmax)
+template<typename T>
+void CalculateActivationPrime(std::vector<T>& result, const std::vector<T>& output, const long count, const Activation activation) {
+    ActivationPrimes(activation, output.data(), result.data(), count);
 }
 
 
 // Calculate the delta between the nets output and the expected output and multiply by the sigmoid prime values
-Vector CalculateLastBiasDelta(const Vector& netOutput, const Vector& expectedOutput, const Vector& dotSigmoidPrime) {
-    Vector result(netOutput.size());
-    
-    for (long i = 0; i < netOutput.size(); i++) {
+// (Element wise, so this works the same for a single sample or a whole batch: count = batchSize x neurons)
+template<typename T>
+void CalculateLastBiasDelta(std::vector<T>& result, const std::vector<T>& netOutput, const std::vector<T>& expectedOutput, const std::vector<T>& dotSigmoidPrime, const long count) {
+    for (long i = 0; i < count; i++) {
         result[i] = (netOutput[i] - expectedOutput[i]) * dotSigmoidPrime[i];
     }
-    
-    return result;
+}
+
+// (Backpropagated through the activation of the output layer straight from the outputs, Softmax included)
+template<typename T>
+void CalculateLastBiasDelta(std::vector<T>& result, const std::vector<T>& netOutput, const std::vector<T>& expectedOutput, const long outputs, const long batchSize, const Activation activation) {
+    for (long i = 0; i < outputs * batchSize; i++) {
+        result[i] = (netOutput[i] - expectedOutput[i]);
+    }
+    ActivationBackward(activation, result.data(), netOutput.data(), outputs, batchSize);
 }
 
 
 //dEdB[i] = dEdB[i+1] .dot( W[i+1].transpose()).  multiply  (H[i].dot(W[i]).add(B[i]).applyFunction(sigmoidePrime));
-Vector CalculateBiasDelta(const Vector& nextBiasDelta, const Matrix& nextWeights, const long rows, const long columns, const Vector& dotSigmoidPrime) {
-    Vector result(dotSigmoidPrime.size());
+// (nextWeights: rows x columns, the transpose is never materialized)
+template<typename T>
+void CalculateBiasDelta(std::vector<T>& result, const std::vector<T>& nextBiasDelta, const std::vector<T>& nextWeights,
+                        const long rows, const long columns, const std::vector<T>& dotSigmoidPrime, const long batchSize) {
+    // Calculate nextBiasDelta DOT transposed nextWeights
+    std::fill(result.begin(), result.begin() + columns * batchSize, 0.0);
+    CalculateDotTransposed(nextWeights.data(), nextBiasDelta.data(), result.data(), rows, columns, batchSize);
     
-    // Transpose weight mat
-    Matrix transposedWeights(nextWeights.size());
-    for (long n = 0; n != nextWeights.size(); n++) {
-        transposedWeights[n] = nextWeights[rows * (n % columns) + (n / columns)];
+    // dotResult * dotSigmoidPrime
+    for (long i = 0; i < columns * batchSize; i++) {
+        result[i] *= dotSigmoidPrime[i];
     }
+}
+
+
+// dEdW = dEdB.transpose().dot(H) averaged over the batch
+// (Same layout as the weight matrix: rows = biasDelta neurons, columns = neurons)
+template<typename T>
+void CalculateWeightDelta(std::vector<T>& result, const std::vector<T>& neurons, const std::vector<T>& biasDelta, const long rows, const long columns, const long batchSize) {
+    std::fill(result.begin(), result.begin() + rows * columns, 0.0);
     
-    // Calculate nextBiasDelta DOT transposedWeights (column count is now row count)
-    const long matColumns = nextBiasDelta.size();
-    const long matRows = columns;
-    Vector dotResult(matRows);
-    
-    for (long r = 0; r < matRows; r++) {
-        for (long c = 0; c < matColumns; c++) {
-            // Get the dot product (sum of multiplications)
-            dotResult[r] += (transposedWeights[r * matColumns + c] * nextBiasDelta[c]);
+    // No transpose needed ... just add up the scaled neuron vectors (row stays in cache for the whole batch)
+    for (long row = 0; row < rows; row++) {
+        for (long b = 0; b < batchSize; b++) {
+            const T delta = biasDelta[b * rows + row] / batchSize;
+            Simd<T>().Axpy(delta, neurons.data() + b * columns, result.data() + row * columns, columns);
         }
     }
+}
+
+
+// dEdW = dEdB.transpose().dot(H) summed (not averaged) over the batch
+template<typename T>
+void CalculateWeightDeltaSum(std::vector<T>& result, const std::vector<T>& neurons, const std::vector<T>& biasDelta, const long rows, const long columns, const long batchSize) {
+    std::fill(result.begin(), result.begin() + rows * columns, 0.0);
     
-    // dotResult * dotSigmoidPrime
-    for (long i = 0; i < dotSigmoidPrime.size(); i++) {
-        result[i] = dotResult[i] * dotSigmoidPrime[i];
+    for (long row = 0; row < rows; row++) {
+        for (long b = 0; b < batchSize; b++) {
+            Simd<T>().Axpy(biasDelta[b * rows + row], neurons.data() + b * columns, result.data() + row * columns, columns);
+        }
     }
-    
-    return result;
 }
 
 
-Matrix CalculateWeightDelta(const Vector& neurons, const Vector& biasDelta) {
-    Matrix result(neurons.size() * biasDelta.size());
-    
-    // No transpose needed ... just dot the vecs
-    for (int row = 0; row < neurons.size(); row++) {
-        for (int col = 0; col < biasDelta.size(); col++) {
-            result[row * biasDelta.size() + col] = (neurons[row] * biasDelta[col]);
+// Sum up the bias deltas of all samples in the batch
+template<typename T>
+void CalculateBatchSum(std::vector<T>& result, const std::vector<T>& values, const long columns, const long batchSize) {
+    std::fill(result.begin(), result.begin() + columns, 0.0);
+    for (long b = 0; b < batchSize; b++) {
+        for (long c = 0; c < columns; c++) {
+            result[c] += values[b * columns + c];
         }
     }
-    
-    return result;
 }
 
 
-// W[i].subtract(dEdW[i].multiply(learningRate))
-Matrix UpdateWeight(const Matrix& weight, const Matrix& weightDelta, const double learnRate) {
-    Matrix result(weight.size());
-    for (long i = 0; i < weight.size(); i++) {
-        result[i] = (weight[i] - (weightDelta[i] * learnRate));
+// Average the bias deltas of all samples in the batch
+template<typename T>
+void CalculateBatchMean(std::vector<T>& result, const std::vector<T>& values, const long columns, const long batchSize) {
+    std::fill(result.begin(), result.begin() + columns, 0.0);
+    for (long b = 0; b < batchSize; b++) {
+        for (long c = 0; c < columns; c++) {
+            result[c] += values[b * columns + c];
+        }
+    }
+    for (long c = 0; c < columns; c++) {
+        result[c] /= batchSize;
     }
-    return result;
+}
+
+
+// W[i].subtract(dEdW[i].multiply(learningRate))
+// (result may be the weight matrix itself, to update it in place)
+template<typename T>
+void UpdateWeight(std::vector<T>& result, const std::vector<T>& weight, const std::vector<T>& weightDelta, const double learnRate) {
+    if (&result != &weight) { std::copy(weight.begin(), weight.end(), result.begin()); }
+    Simd<T>().Axpy((T)(-learnRate), weightDelta.data(), result.data(), weight.size());
 }
 
 
 // B[i].subtract(dEdB[i].multiply(learningRate))
-Vector UpdateBias(const Vector& bias, const Vector& biasDelta, const double learnRate) {
-    Vector result(bias.size());
+// (result may be the bias vector itself, to update it in place)
+template<typename T>
+void UpdateBias(std::vector<T>& result, const std::vector<T>& bias, const std::vector<T>& biasDelta, const double learnRate) {
     for (long i = 0; i < bias.size(); i++) {
-        result[i] = (bias[i] - (biasDelta[i] * learnRate));
+        result[i] = (bias[i] - (biasDelta[i] * (T)learnRate));
     }
+}
+
+
+// Fused gradient and update: W -= learnRate * dEdB.transpose().dot(H) / batchSize
+// The outer product is added to the weights row by row, while the row is in the cache,
+// so every weight is read and written once per batch and dEdW is never materialized
+template<typename T>
+void UpdateWeightFused(std::vector<T>& weight, const std::vector<T>& neurons, const std::vector<T>& biasDelta, const long rows, const long columns, const long batchSize, const double learnRate) {
+    const SimdKernelsT<T>& simd = Simd<T>();
+    for (long row = 0; row < rows; row++) {
+        for (long b = 0; b < batchSize; b++) {
+            const T delta = biasDelta[b * rows + row] / batchSize;
+            simd.Axpy((T)(-learnRate) * delta, neurons.data() + b * columns, weight.data() + row * columns, columns);
+        }
+    }
+}
+
+
+// Fused batch mean and update: B -= learnRate * mean(dEdB)
+template<typename T>
+void UpdateBiasFused(std::vector<T>& bias, const std::vector<T>& biasDelta, const long columns, const long batchSize, const double learnRate) {
+    const T scale = learnRate / batchSize;
+    for (long b = 0; b < batchSize; b++) {
+        for (long c = 0; c < columns; c++) {
+            bias[c] -= (biasDelta[b * columns + c] * scale);
+        }
+    }
+}
+
+
+// Sparse input layer: Most input pixels are exactly zero, and a zero input neither adds to the dot product
+// nor changes its weights. The kernels below run only over the nonzero inputs of each sample. They work on the
+// input-major (transposed, inputs x neurons) weights of the layer, so the weights of one input are contiguous
+// and every nonzero input is a single unit stride Axpy (a gather on the row-major weights is slower than dense).
+// Sparse pays off below SPARSE_INPUT_DENSITY nonzero inputs (the dense row-major kernels win above)
+#define SPARSE_INPUT_DENSITY        0.4                         // Max. share of nonzero inputs for the sparse input layer
+
+
+// Indices of the nonzero inputs of each sample: indices (batchSize x inputs) / counts (batchSize)
+template<typename T>
+void GatherNonZero(const T* values, long* indices, long* counts, const long inputs, const long batchSize) {
+    for (long b = 0; b < batchSize; b++) {
+        const T* x = values + b * inputs;
+        long* index = indices + b * inputs;
+        long count = 0;
+        for (long c = 0; c < inputs; c++) {
+            index[count] = c;
+            count += (x[c] != 0);
+        }
+        counts[b] = count;
+    }
+}
+
+
+// result (batchSize x neurons) = f(weightsT (inputs x neurons) DOT values (batchSize x inputs) + bias)
+// over the gathered nonzero inputs only (same sums as CalculateDotActivation, in another order)
+template<typename T>
+void CalculateDotActivationSparse(std::vector<T>& result, const T* weightsT, const std::vector<T>& values, const long* indices, const long* counts,
+                                  const T* bias, const long neurons, const long inputs, const long batchSize, const Activation activation) {
+    const SimdKernelsT<T>& simd = Simd<T>();
+    for (long b = 0; b < batchSize; b++) {
+        const T* x = values.data() + b * inputs;
+        const long* index = indices + b * inputs;
+        T* out = result.data() + b * neurons;
+        std::copy(bias, bias + neurons, out);
+        for (long k = 0; k < counts[b]; k++) {
+            simd.Axpy(x[index[k]], weightsT + index[k] * neurons, out, neurons);
+        }
+    }
+    Activate(activation, result.data(), neurons, batchSize);
+}
+
+
+// Fused sparse gradient and update: WT -= learnRate * values.transpose().dot(dEdB) / batchSize
+// (plain SGD only, the weights of the zero inputs keep their values)
+template<typename T>
+void UpdateWeightFusedSparse(std::vector<T>& weightT, const std::vector<T>& values, const long* indices, const long* counts, const std::vector<T>& biasDelta,
+                             const long neurons, const long inputs, const long batchSize, const double learnRate) {
+    const SimdKernelsT<T>& simd = Simd<T>();
+    const T scale = (T)(-learnRate) / batchSize;
+    for (long b = 0; b < batchSize; b++) {
+        const T* x = values.data() + b * inputs;
+        const long* index = indices + b * inputs;
+        for (long k = 0; k < counts[b]; k++) {
+            simd.Axpy(scale * x[index[k]], biasDelta.data() + b * neurons, weightT.data() + index[k] * neurons, neurons);
+        }
+    }
+}
+
+
+// weightsT (columns x rows) = weights (rows x columns) transposed
+template<typename T>
+void TransposeMatrix(T* weightsT, const T* weights, const long rows, const long columns) {
+    for (long r = 0; r < rows; r++) {
+        for (long c = 0; c < columns; c++) {
+            weightsT[c * rows + r] = weights[r * columns + c];
+        }
+    }
+}
+
+
+// Allocating versions of the kernels (sized from the input vectors)
+
+
+template<typename T>
+std::vector<T> CalculateDotSigmoid(const std::vector<T>& weights, const std::vector<T>& values, const std::vector<T>& bias, const long matRows, const long batchSize = 1) {
+    std::vector<T> result(matRows * batchSize);
+    CalculateDotSigmoid(result, weights, values, bias, matRows, values.size() / batchSize, batchSize);
+    return result;
+}
+
+
+template<typename T>
+std::vector<T> CalculateDotSigmoidPrime(const std::vector<T>& weights, const std::vector<T>& values, const std::vector<T>& bias, const long matRows, const long batchSize = 1) {
+    std::vector<T> result(matRows * batchSize);
+    CalculateDotSigmoidPrime(result, weights, values, bias, matRows, values.size() / batchSize, batchSize);
+    return result;
+}
+
+
+template<typename T>
+std::vector<T> CalculateLastBiasDelta(const std::vector<T>& netOutput, const std::vector<T>& expectedOutput, const std::vector<T>& dotSigmoidPrime) {
+    std::vector<T> result(netOutput.size());
+    CalculateLastBiasDelta(result, netOutput, expectedOutput, dotSigmoidPrime, netOutput.size());
+    return result;
+}
+
+
+template<typename T>
+std::vector<T> CalculateBiasDelta(const std::vector<T>& nextBiasDelta, const std::vector<T>& nextWeights, const long rows, const long columns, const std::vector<T>& dotSigmoidPrime, const long batchSize = 1) {
+    std::vector<T> result(dotSigmoidPrime.size());
+    CalculateBiasDelta(result, nextBiasDelta, nextWeights, rows, columns, dotSigmoidPrime, batchSize);
+    return result;
+}
+
+
+template<typename T>
+std::vector<T> CalculateWeightDelta(const std::vector<T>& neurons, const std::vector<T>& biasDelta, const long batchSize = 1) {
+    const long rows = biasDelta.size() / batchSize;
+    const long columns = neurons.size() / batchSize;
+    std::vector<T> result(rows * columns);
+    CalculateWeightDelta(result, neurons, biasDelta, rows, columns, batchSize);
+    return result;
+}
+
+
+template<typename T>
+std::vector<T> CalculateBatchMean(const std::vector<T>& values, const long batchSize = 1) {
+    std::vector<T> result(values.size() / batchSize);
+    CalculateBatchMean(result, values, result.size(), batchSize);
+    return result;
+}
+
+
+template<typename T>
+std::vector<T> UpdateWeight(const std::vector<T>& weight, const std::vector<T>& weightDelta, const double learnRate) {
+    std::vector<T> result(weight.size());
+    UpdateWeight(result, weight, weightDelta, learnRate);
+    return result;
+}
+
+
+template<typename T>
+std::vector<T> UpdateBias(const std::vector<T>& bias, const std::vector<T>& biasDelta, const double learnRate) {
+    std::vector<T> result(bias.size());
+    UpdateBias(result, bias, biasDelta, learnRate);
     return result;
 }
@@ -0,0 +1,140 @@
+//  NetOptimizer.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include "../NetModel.h"
+#include "NetSimd.h"
+
+// Weight update rules of NeuralNetVec. Every optimizer is one fused SIMD pass over a weight
+// array (see the *Step kernels in NetSimd.h): it reads the gradient and the optimizer state
+// and writes the weights and the state, without any temporary arrays.
+// The state has "slots" arrays of the weight / bias shape per layer (stored like in the model
+// files, see NetModel.h, so it is exported and imported with the weights):
+//   SGD:       no state                  w -= learnRate * g
+//   Momentum:  delta (the last change)   (same update rule as the momentum of NeuralNetOOP)
+//   Nesterov:  delta                     momentum with the look ahead step
+//   Adam:      first / second moment     the bias correction is folded into the learning rate of each step
+
+struct NetOptimizer {
+    ModelOptimizer type;
+    double momentum;                        // Momentum / Nesterov: multiplier of the last delta
+    double beta1, beta2, epsilon;           // Adam
+
+    static NetOptimizer SGD() { return NetOptimizer{ ModelOptimizer::SGD, 0.0, 0.0, 0.0, 0.0 }; }
+    static NetOptimizer Momentum(double momentum = ALPHA) { return NetOptimizer{ ModelOptimizer::Momentum, momentum, 0.0, 0.0, 0.0 }; }
+    static NetOptimizer Nesterov(double momentum = ALPHA) { return NetOptimizer{ ModelOptimizer::Nesterov, momentum, 0.0, 0.0, 0.0 }; }
+    static NetOptimizer Adam(double beta1 = ADAM_BETA1, double beta2 = ADAM_BETA2, double epsilon = ADAM_EPSILON) {
+        return NetOptimizer{ ModelOptimizer::Adam, 0.0, beta1, beta2, epsilon };
+    }
+
+    // The default settings of an optimizer type (e.g. of an imported model)
+    static NetOptimizer Default(ModelOptimizer type) {
+        switch (type) {
+            case ModelOptimizer::Momentum: return Momentum();
+            case ModelOptimizer::Nesterov: return Nesterov();
+            case ModelOptimizer::Adam:     return Adam();
+            default:                       return SGD();
+        }
+    }
+
+    inline ulong slots() const { return ModelOptimizerSlots(type); }
+
+    // Learning rate of update number "step" (1, 2, ...)
+    inline double StepLearnRate(double learnRate, ulong step) const {
+        if (type != ModelOptimizer::Adam) { return learnRate; }
+        return learnRate * sqrt(1 - pow(beta2, (double)step)) / (1 - pow(beta1, (double)step));
+    }
+
+    static const char* Name(ModelOptimizer type) {
+        switch (type) {
+            case ModelOptimizer::Momentum: return "Momentum";
+            case ModelOptimizer::Nesterov: return "Nesterov";
+            case ModelOptimizer::Adam:     return "Adam";
+            default:                       return "SGD";
+        }
+    }
+};
+
+
+// One optimizer step on n weights w with the gradient g = gradientScale * gradient
+// (slot0 / slot1: the state of the weights, nullptr if the optimizer has less slots)
+template<typename T>
+void OptimizerStep(const NetOptimizer& optimizer, double learnRate, const T* gradient, double gradientScale, T* w, T* slot0, T* slot1, long n) {
+    const SimdKernelsT<T>& simd = Simd<T>();
+    switch (optimizer.type) {
+        case ModelOptimizer::Momentum:
+            simd.MomentumStep(gradient, (T)gradientScale, w, slot0, n, (T)learnRate, (T)optimizer.momentum);
+            break;
+        case ModelOptimizer::Nesterov:
+            simd.NesterovStep(gradient, (T)gradientScale, w, slot0, n, (T)learnRate, (T)optimizer.momentum);
+            break;
+        case ModelOptimizer::Adam:
+            simd.AdamStep(gradient, (T)gradientScale, w, slot0, slot1, n, (T)learnRate, (T)optimizer.beta1, (T)optimizer.beta2, (T)optimizer.epsilon);
+            break;
+        default:
+            simd.Axpy((T)(-learnRate * gradientScale), gradient, w, n);
+            break;
+    }
+}
+
+
+// Fused gradient and optimizer step: W -= step(dEdB.transpose().dot(H) / batchSize)
+// The gradient of one weight row is summed up in "gradientRow" (columns values, stays in the cache)
+// and applied with the state of the row in one pass, so dEdW is never materialized
+template<typename T>
+void UpdateWeightOptimizer(const NetOptimizer& optimizer, double learnRate, std::vector<T>& weight, T* slot0, T* slot1, const std::vector<T>& neurons,
+                           const std::vector<T>& biasDelta, const long rows, const long columns, const long batchSize, T* gradientRow) {
+    const SimdKernelsT<T>& simd = Simd<T>();
+    for (long row = 0; row < rows; row++) {
+        std::fill(gradientRow, gradientRow + columns, 0.0);
+        for (long b = 0; b < batchSize; b++) {
+            simd.Axpy(biasDelta[b * rows + row], neurons.data() + b * columns, gradientRow, columns);
+        }
+        const long r = row * columns;
+        OptimizerStep<T>(optimizer, learnRate, gradientRow, 1.0 / batchSize, weight.data() + r,
+                         slot0 ? slot0 + r : nullptr, slot1 ? slot1 + r : nullptr, columns);
+    }
+}
+
+
+// Fused batch mean and optimizer step: B -= step(mean(dEdB))
+template<typename T>
+void UpdateBiasOptimizer(const NetOptimizer& optimizer, double learnRate, std::vector<T>& bias, T* slot0, T* slot1,
+                         const std::vector<T>& biasDelta, const long columns, const long batchSize, T* gradientRow) {
+    std::fill(gradientRow, gradientRow + columns, 0.0);
+    for (long b = 0; b < batchSize; b++) {
+        for (long c = 0; c < columns; c++) {
+            gradientRow[c] += biasDelta[b * columns + c];
+        }
+    }
+    OptimizerStep<T>(optimizer, learnRate, gradientRow, 1.0 / batchSize, bias.data(), slot0, slot1, columns);
+}
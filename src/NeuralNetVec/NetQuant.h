@@ -0,0 +1,430 @@
+//  NetQuant.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <stdint.h>
+
+#include "NeuralNetVec.h"
+
+// Int8 post-training quantization of a trained NeuralNetVec for inference:
+//   weights:      int8, one scale per weight matrix row (max |w| of the row maps to QUANT_WEIGHT_MAX)
+//   activations:  7-Bit unsigned (0 .. 127 = 0.0 .. 1.0), the sigmoid outputs and the normalized pixels
+//   dot product:  exact int32 sums of u8 x s8 products, dequantized with the row scale before the bias
+//   sigmoid:      lookup table per hidden layer, its range is calibrated on a sample of the training data
+// The 7-Bit activations keep the 16-Bit pair sums of the AVX2 maddubs instruction from saturating
+// (2 x 127 x 127 < 32767), so every kernel (scalar, AVX2, AVX-512 VNNI) returns the same sums
+// and the quantized net gives the same results on every CPU.
+// The rows are padded with zero weights to whole AVX-512 registers, so the kernels have no tail loops.
+
+#define QUANT_WEIGHT_MAX            127
+#define QUANT_ACTIVATION_MAX        127
+#define QUANT_ROW_ALIGNMENT         64                          // Columns per row are padded to a multiple of this
+#define QUANT_SIGMOID_LUT           4096                        // Entries of the sigmoid lookup table of a layer
+#define QUANT_SIGMOID_RANGE         8.0                         // Widest table range: sigmoid(8) * 127 rounds to 127 already
+#define QUANT_CALIBRATION           1000                        // Training digits used for the calibration
+
+enum class QuantLevel { Scalar, AVX2, AVX512VNNI };
+
+
+// Function table of one instruction set, n has to be a multiple of QUANT_ROW_ALIGNMENT
+struct QuantKernels {
+    QuantLevel level;
+    const char* name;
+    // Dot product of n unsigned 7-Bit activations and n signed weights
+    int32_t (*Dot)(const byte* x, const int8_t* w, long n);
+    // Register blocked dot product of 4 weight rows (stride apart) with one activation vector: out[0..3] = rows.x
+    void (*Dot4)(const byte* x, const int8_t* rows, long stride, long n, int32_t* out);
+};
+
+
+// Scalar reference kernels
+namespace quant_scalar {
+    int32_t Dot(const byte* x, const int8_t* w, long n) {
+        int32_t sum = 0;
+        for (long i = 0; i < n; i++) { sum += (x[i] * w[i]); }
+        return sum;
+    }
+
+    void Dot4(const byte* x, const int8_t* rows, long stride, long n, int32_t* out) {
+        for (long r = 0; r < 4; r++) { out[r] = Dot(x, rows + r * stride, n); }
+    }
+}
+
+
+#if SIMD_X86
+
+// AVX2: maddubs multiplies 32 u8 x s8 pairs and adds neighbours to 16-Bit, madd with 1 widens them to 32-Bit
+#if defined(__clang__)
+    #pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC target("avx2")
+#endif
+namespace quant_avx2 {
+    static inline __m256i MulAdd(__m256i sum, __m256i x, const int8_t* w) {
+        const __m256i pairs = _mm256_maddubs_epi16(x, _mm256_loadu_si256((const __m256i*)w));
+        return _mm256_add_epi32(sum, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+    }
+
+    static inline int32_t Sum(__m256i r) {
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+        return _mm_cvtsi128_si32(s);
+    }
+
+    int32_t Dot(const byte* x, const int8_t* w, long n) {
+        __m256i sum = _mm256_setzero_si256();
+        for (long i = 0; i < n; i += 32) { sum = MulAdd(sum, _mm256_loadu_si256((const __m256i*)(x + i)), w + i); }
+        const int32_t result = Sum(sum);
+        _mm256_zeroupper();
+        return result;
+    }
+
+    void Dot4(const byte* x, const int8_t* rows, long stride, long n, int32_t* out) {
+        __m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+        for (long i = 0; i < n; i += 32) {
+            const __m256i xv = _mm256_loadu_si256((const __m256i*)(x + i));
+            s0 = MulAdd(s0, xv, rows + i);
+            s1 = MulAdd(s1, xv, rows + stride + i);
+            s2 = MulAdd(s2, xv, rows + 2 * stride + i);
+            s3 = MulAdd(s3, xv, rows + 3 * stride + i);
+        }
+        out[0] = Sum(s0);
+        out[1] = Sum(s1);
+        out[2] = Sum(s2);
+        out[3] = Sum(s3);
+        _mm256_zeroupper();
+    }
+}
+#if defined(__clang__)
+    #pragma clang attribute pop
+#elif defined(__GNUC__)
+    #pragma GCC pop_options
+#endif
+
+
+// AVX-512 VNNI: vpdpbusd multiplies 64 u8 x s8 pairs and adds groups of 4 straight into 32-Bit sums
+#if defined(__clang__)
+    #pragma clang attribute push (__attribute__((target("avx512f,avx512bw,avx512vnni"))), apply_to = function)
+#elif defined(__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC target("avx512f,avx512bw,avx512vnni")
+#endif
+namespace quant_avx512vnni {
+    static inline __m512i MulAdd(__m512i sum, __m512i x, const int8_t* w) {
+        return _mm512_dpbusd_epi32(sum, x, _mm512_loadu_si512((const void*)w));
+    }
+
+    static inline int32_t Sum(__m512i r) {
+        // (Through memory, see NetSimd.h)
+        alignas(64) int32_t lanes[16];
+        _mm512_store_si512((void*)lanes, r);
+        int32_t sum = 0;
+        for (long i = 0; i < 16; i++) { sum += lanes[i]; }
+        return sum;
+    }
+
+    int32_t Dot(const byte* x, const int8_t* w, long n) {
+        __m512i sum = _mm512_setzero_si512();
+        for (long i = 0; i < n; i += 64) { sum = MulAdd(sum, _mm512_loadu_si512((const void*)(x + i)), w + i); }
+        const int32_t result = Sum(sum);
+        _mm256_zeroupper();
+        return result;
+    }
+
+    void Dot4(const byte* x, const int8_t* rows, long stride, long n, int32_t* out) {
+        __m512i s0 = _mm512_setzero_si512(), s1 = s0, s2 = s0, s3 = s0;
+        for (long i = 0; i < n; i += 64) {
+            const __m512i xv = _mm512_loadu_si512((const void*)(x + i));
+            s0 = MulAdd(s0, xv, rows + i);
+            s1 = MulAdd(s1, xv, rows + stride + i);
+            s2 = MulAdd(s2, xv, rows + 2 * stride + i);
+            s3 = MulAdd(s3, xv, rows + 3 * stride + i);
+        }
+        out[0] = Sum(s0);
+        out[1] = Sum(s1);
+        out[2] = Sum(s2);
+        out[3] = Sum(s3);
+        _mm256_zeroupper();
+    }
+}
+#if defined(__clang__)
+    #pragma clang attribute pop
+#elif defined(__GNUC__)
+    #pragma GCC pop_options
+#endif
+
+#endif // SIMD_X86
+
+
+// Get the best integer instruction set this CPU (and OS) supports
+QuantLevel DetectQuantLevel() {
+#if SIMD_X86
+    bool vnni = false;
+    #if defined(_MSC_VER)
+        int info[4] = {0};
+        __cpuid(info, 0);
+        const int maxLeaf = info[0];
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (osxsave && maxLeaf >= 7) {
+            const unsigned long long xcr0 = _xgetbv(0);
+            __cpuidex(info, 7, 0);
+            // AVX-512 F + BW and VNNI (ECX bit 11)
+            vnni = ((info[1] & (1 << 16)) != 0) && ((info[1] & (1 << 30)) != 0) && ((info[2] & (1 << 11)) != 0) && ((xcr0 & 0xE6) == 0xE6);
+        }
+    #else
+        __builtin_cpu_init();
+        vnni = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vnni");
+    #endif
+    if (vnni) { return QuantLevel::AVX512VNNI; }
+    if (DetectSimdLevel() >= SimdLevel::AVX2) { return QuantLevel::AVX2; }
+#endif
+    return QuantLevel::Scalar;
+}
+
+
+// Get the kernel table of an instruction set (falls back to scalar if it is not compiled in)
+const QuantKernels& GetQuantKernels(QuantLevel level) {
+    static const QuantKernels scalarKernels = { QuantLevel::Scalar, "Scalar", quant_scalar::Dot, quant_scalar::Dot4 };
+#if SIMD_X86
+    static const QuantKernels avx2Kernels = { QuantLevel::AVX2, "AVX2", quant_avx2::Dot, quant_avx2::Dot4 };
+    static const QuantKernels vnniKernels = { QuantLevel::AVX512VNNI, "AVX-512 VNNI", quant_avx512vnni::Dot, quant_avx512vnni::Dot4 };
+    switch (level) {
+        case QuantLevel::AVX2:       return avx2Kernels;
+        case QuantLevel::AVX512VNNI: return vnniKernels;
+        default: break;
+    }
+#endif
+    return scalarKernels;
+}
+
+
+// The kernels used by the quantized nets: Detected once on first use, can be forced to a lower level
+const QuantKernels*& ActiveQuantKernels() {
+    static const QuantKernels* active = &GetQuantKernels(DetectQuantLevel());
+    return active;
+}
+
+inline const QuantKernels& QuantSimd() { return *ActiveQuantKernels(); }
+
+void SetQuantLevel(QuantLevel level) {
+    if (level > DetectQuantLevel()) { level = DetectQuantLevel(); }
+    ActiveQuantKernels() = &GetQuantKernels(level);
+}
+
+
+// Int8 copy of a trained net for inference (one digit at a time, not thread safe: one instance per thread)
+class NeuralNetQuant {
+private:
+    Topology _layers;
+    long _lastLayer;
+    std::vector<long> _strides;                         // Padded columns of every weight matrix
+    std::vector<std::vector<int8_t>> _weights;          // W (rows x stride, zero padded)
+    std::vector<std::vector<float>> _rowScales;         // Dequantization of the int32 row sums (weight scale x activation scale)
+    std::vector<std::vector<float>> _biases;            // B (float, added after the dequantization)
+    std::vector<float> _sigmoidRanges;                  // Calibrated |z| range of the sigmoid table of every hidden layer
+    std::vector<std::vector<byte>> _sigmoidTables;      // 7-Bit sigmoid outputs over [-range, range]
+    byte _pixelTable[256];                              // 8-Bit pixel -> 7-Bit activation
+    std::vector<std::vector<byte>> _activations;        // Input and hidden layer activations (padded, the padding stays 0)
+    std::vector<int32_t> _sums;
+
+public:
+    // Quantize a trained net, the sigmoid tables are calibrated on "calibrationCount" digits spread over the calibration set
+    template<typename T>
+    NeuralNetQuant(const NeuralNetVecT<T>& net, const MNISTset& calibrationData, long calibrationCount = QUANT_CALIBRATION)
+    : _layers(net.layers()), _lastLayer(_layers.size() - 1) {
+        if (calibrationData.imageSize() != _layers.front() || calibrationData.size() == 0) {
+            std::cout <<"ERROR: the calibration digits do not fit the " <<_layers.front() <<" input neuron net" <<std::endl;
+            _layers.clear();
+            return;
+        }
+        // The 7-Bit activations and the lookup tables hold sigmoid outputs (0.0 .. 1.0)
+        if (net.hiddenActivation() != Activation::Sigmoid || net.outputActivation() != Activation::Sigmoid) {
+            std::cout <<"ERROR: only sigmoid nets can be quantized" <<std::endl;
+            _layers.clear();
+            return;
+        }
+        for (long p = 0; p < 256; p++) { _pixelTable[p] = (byte)lround(p * (double)QUANT_ACTIVATION_MAX / 255); }
+        
+        for (long i = 0; i < _lastLayer; i++) {
+            const long rows = _layers[i + 1], columns = _layers[i];
+            const long stride = (columns + QUANT_ROW_ALIGNMENT - 1) / QUANT_ROW_ALIGNMENT * QUANT_ROW_ALIGNMENT;
+            const T* W = net.weights(i);
+            _strides.push_back(stride);
+            _weights.push_back(std::vector<int8_t>(rows * stride, 0));
+            _rowScales.push_back(std::vector<float>(rows));
+            _biases.push_back(std::vector<float>(net.biases(i), net.biases(i) + rows));
+            for (long r = 0; r < rows; r++) {
+                // Symmetric per row scale: the largest weight of the row maps to +-QUANT_WEIGHT_MAX
+                double maxWeight = 0.0;
+                for (long c = 0; c < columns; c++) { maxWeight = std::max<double>(maxWeight, fabs(W[r * columns + c])); }
+                const double scale = (maxWeight > 0.0) ? (maxWeight / QUANT_WEIGHT_MAX) : 1.0;
+                for (long c = 0; c < columns; c++) { _weights[i][r * stride + c] = (int8_t)lround(W[r * columns + c] / scale); }
+                _rowScales[i][r] = (float)(scale / QUANT_ACTIVATION_MAX);
+            }
+            _activations.push_back(std::vector<byte>(stride, 0));
+        }
+        _sums = std::vector<int32_t>(*std::max_element(_layers.begin() + 1, _layers.end()));
+        
+        Calibrate(net, calibrationData, calibrationCount);
+    }
+    
+    
+    // Classify one digit: "output" receives the sigmoid outputs of the output layer
+    void FeedForward(const MNISTchar& digit, float* output) {
+        byte* input = _activations[0].data();
+        for (ulong c = 0; c < _layers.front(); c++) { input[c] = _pixelTable[digit.pixelData[c]]; }
+        
+        for (long i = 0; i < _lastLayer; i++) {
+            const long rows = _layers[i + 1];
+            MatVec(i);
+            if (i + 1 == _lastLayer) {
+                for (long r = 0; r < rows; r++) { output[r] = 1.0f / (1.0f + expf(-Dequantize(i, r))); }
+                break;
+            }
+            const byte* table = _sigmoidTables[i].data();
+            const float tableScale = (QUANT_SIGMOID_LUT - 1) / (2.0f * _sigmoidRanges[i]);
+            byte* next = _activations[i + 1].data();
+            for (long r = 0; r < rows; r++) {
+                const float index = (Dequantize(i, r) + _sigmoidRanges[i]) * tableScale + 0.5f;
+                next[r] = table[(index <= 0.0f) ? 0 : std::min<long>((long)index, QUANT_SIGMOID_LUT - 1)];
+            }
+        }
+    }
+    
+    std::vector<float> FeedForward(const MNISTchar& digit) {
+        std::vector<float> output(_layers.back());
+        FeedForward(digit, output.data());
+        return output;
+    }
+    
+    
+    // GETTER
+    inline bool isValid() const { return !_layers.empty(); }
+    inline const Topology& layers() const { return _layers; }
+    inline float sigmoidRange(long layer) const { return _sigmoidRanges[layer]; }
+    // Memory of the quantized weights (with the padding, scales and biases)
+    ulong weightBytes() const {
+        ulong bytes = 0;
+        for (long i = 0; i < _lastLayer; i++) { bytes += _weights[i].size() + (_rowScales[i].size() + _biases[i].size()) * sizeof(float); }
+        return bytes;
+    }
+    
+private:
+    // Integer row sums of layer i: 4 rows share every activation load
+    void MatVec(long i) {
+        const QuantKernels& kernels = QuantSimd();
+        const long rows = _layers[i + 1], stride = _strides[i];
+        const byte* x = _activations[i].data();
+        const int8_t* W = _weights[i].data();
+        long r = 0;
+        for (; r + 4 <= rows; r += 4) { kernels.Dot4(x, W + r * stride, stride, stride, _sums.data() + r); }
+        for (; r < rows; r++) { _sums[r] = kernels.Dot(x, W + r * stride, stride); }
+    }
+    
+    inline float Dequantize(long i, long r) const { return _sums[r] * _rowScales[i][r] + _biases[i][r]; }
+    
+    
+    // Feed the calibration digits through the float net and size the sigmoid table of every hidden
+    // layer to the largest |z| that occurs (capped at QUANT_SIGMOID_RANGE, where the sigmoid is saturated)
+    template<typename T>
+    void Calibrate(const NeuralNetVecT<T>& net, const MNISTset& calibrationData, long calibrationCount) {
+        const long count = std::max<long>(1, std::min<long>(calibrationCount, calibrationData.size()));
+        const long step = calibrationData.size() / count;
+        std::vector<double> maxZ(_lastLayer, 0.0);
+        std::vector<std::vector<T>> H(_layers.size());
+        for (ulong l = 0; l < _layers.size(); l++) { H[l] = std::vector<T>(_layers[l]); }
+        
+        for (long n = 0; n < count; n++) {
+            calibrationData[n * step].normalizedPixels(H[0].data());
+            for (long i = 0; i < _lastLayer; i++) {
+                const long rows = _layers[i + 1], columns = _layers[i];
+                for (long r = 0; r < rows; r++) {
+                    const double z = Simd<T>().Dot(net.weights(i) + r * columns, H[i].data(), columns) + net.biases(i)[r];
+                    maxZ[i] = std::max(maxZ[i], fabs(z));
+                    H[i + 1][r] = (T)(1 / (1 + exp(-z)));
+                }
+            }
+        }
+        
+        for (long i = 0; i < _lastLayer - 1; i++) {
+            const double range = std::min(std::max(maxZ[i], 1.0), QUANT_SIGMOID_RANGE);
+            _sigmoidRanges.push_back((float)range);
+            _sigmoidTables.push_back(std::vector<byte>(QUANT_SIGMOID_LUT));
+            for (long k = 0; k < QUANT_SIGMOID_LUT; k++) {
+                const double z = -range + (2 * range * k) / (QUANT_SIGMOID_LUT - 1);
+                _sigmoidTables[i][k] = (byte)lround(QUANT_ACTIVATION_MAX / (1 + exp(-z)));
+            }
+        }
+    }
+    
+};
+
+
+// Accuracy of the quantized net next to the float net it was made from
+struct QuantReport {
+    ulong samples;
+    double floatAccuracy, quantAccuracy;    // % of the digits recognized (strongest output neuron == label)
+    double agreement;                       // % of the digits where both nets pick the same class
+    double maxOutputError;                  // Largest difference of an output neuron
+    ulong floatBytes, quantBytes;           // Memory of the weights and biases
+};
+
+template<typename T>
+QuantReport CompareQuantized(NeuralNetVecT<T>& net, NeuralNetQuant& quant, const MNISTset& testData) {
+    QuantReport report = {};
+    if (!quant.isValid() || testData.size() == 0) { return report; }
+    long floatCorrect = 0, quantCorrect = 0, agree = 0;
+    std::vector<float> quantOutput(MNIST_CLASSES);
+    for (const auto t : testData) {
+        const auto floatOutput = net.FeedForward(t);
+        quant.FeedForward(t, quantOutput.data());
+        const long floatClass = std::max_element(floatOutput.begin(), floatOutput.end()) - floatOutput.begin();
+        const long quantClass = std::max_element(quantOutput.begin(), quantOutput.end()) - quantOutput.begin();
+        if (floatClass == t.label) { floatCorrect++; }
+        if (quantClass == t.label) { quantCorrect++; }
+        if (floatClass == quantClass) { agree++; }
+        for (long o = 0; o < MNIST_CLASSES; o++) {
+            report.maxOutputError = std::max<double>(report.maxOutputError, fabs(floatOutput[o] - quantOutput[o]));
+        }
+    }
+    report.samples = testData.size();
+    report.floatAccuracy = (100.0 * floatCorrect) / report.samples;
+    report.quantAccuracy = (100.0 * quantCorrect) / report.samples;
+    report.agreement = (100.0 * agree) / report.samples;
+    const Topology& layers = net.layers();
+    for (ulong i = 0; i + 1 < layers.size(); i++) { report.floatBytes += (layers[i + 1] * (layers[i] + 1)) * sizeof(T); }
+    report.quantBytes = quant.weightBytes();
+    return report;
+}
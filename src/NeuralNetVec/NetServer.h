@@ -0,0 +1,476 @@
+//  NetServer.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <list>
+
+#if !WINDOWS
+    #include <sys/socket.h>
+    #include <sys/un.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
+    #include <unistd.h>
+#endif
+
+#include "NeuralNetVec.h"
+
+// Local inference server of a NeuralNetVec: Clients connect to a Unix domain socket ("unix:/path")
+// or to a TCP port on localhost ("tcp:port") and send raw images (imageSize bytes, 0-255 per pixel,
+// e.g. 784 for MNIST), the server replies to every image with a NetServerReply.
+// Every connection handles one image at a time, so concurrent requests come from several connections:
+// They are queued and coalesced into micro-batches of at most SERVER_MAX_BATCH images, a batch starts
+// as soon as it is full, its oldest image has waited SERVER_MAX_WAIT microseconds or every open connection
+// waits for a reply (no more images can come, e.g. a single client never waits). The worker threads
+// run the batches on their own Snapshot of the net. NetServerClient is the client side (see serverBench.cpp).
+// (POSIX sockets, not available on Windows)
+
+#define SERVER_MAX_BATCH            64                          // Images per micro-batch
+#define SERVER_MAX_WAIT             500                         // Microseconds the first image of a batch waits for more images
+#define SERVER_WORKERS              0                           // Inference threads (0 = all cores)
+#define SERVER_BACKLOG              64                          // Pending connections of the listening socket
+#define SERVER_LATENCY_STEPS        16                          // Latency histogram buckets per doubling (4.4% wide)
+#define SERVER_LATENCY_BUCKETS      (SERVER_LATENCY_STEPS * 32 + 1)   // Below 1 us, then 1 us up to 2^32 us (longer ones land in the last)
+
+
+// Reply to one image: The strongest output neuron and all the outputs
+struct NetServerReply {
+    uint32_t label;
+    float outputs[MNIST_CLASSES];
+};
+
+
+struct NetServerStats {
+    ulong requests, batches;
+    double seconds;                         // Since Start() / ResetStats()
+    double requestsPerSec;
+    double meanBatch;                       // Images per batch
+    double p50, p99, max;                   // Latency (microseconds) from the complete image to the finished reply
+};
+
+
+// Latencies of a server in logarithmic buckets: fixed memory for any number of requests, the percentiles
+// are the upper bounds of their buckets (at most SERVER_LATENCY_STEPS-th of a doubling too high), max is exact
+struct NetLatencyHistogram {
+    std::array<ulong, SERVER_LATENCY_BUCKETS> counts;
+    ulong total;
+    double max;                             // Microseconds
+    
+    NetLatencyHistogram() { Clear(); }
+    
+    void Clear() {
+        counts.fill(0);
+        total = 0;
+        max = 0.0;
+    }
+    
+    void Add(double microseconds) {
+        const long bucket = (microseconds < 1.0) ? 0 : 1 + (long)(std::log2(microseconds) * SERVER_LATENCY_STEPS);
+        counts[std::min<long>(bucket, SERVER_LATENCY_BUCKETS - 1)]++;
+        total++;
+        max = std::max(max, microseconds);
+    }
+    
+    // Latency that a share p (0 - 1) of the requests did not exceed
+    double Percentile(double p) const {
+        if (total == 0) { return 0.0; }
+        const ulong rank = std::max<ulong>(1, (ulong)std::ceil(p * total));
+        ulong count = 0;
+        for (long b = 0; b < SERVER_LATENCY_BUCKETS; b++) {
+            count += counts[b];
+            if (count >= rank) { return std::min(max, std::exp2((double)b / SERVER_LATENCY_STEPS)); }
+        }
+        return max;
+    }
+};
+
+
+#if !WINDOWS
+// Socket helpers of the server and the client: "unix:/path" or "tcp:port" (localhost only)
+struct NetSocketAddress {
+    sockaddr_storage address;
+    socklen_t length;
+    int family;
+    
+    bool Parse(const std::string& text) {
+        memset(&address, 0, sizeof(address));
+        if (text.compare(0, 5, "unix:") == 0 && text.size() > 5 && text.size() - 5 < sizeof(sockaddr_un::sun_path)) {
+            sockaddr_un* local = (sockaddr_un*)&address;
+            local->sun_family = family = AF_UNIX;
+            strcpy(local->sun_path, text.c_str() + 5);
+            length = sizeof(sockaddr_un);
+            return true;
+        }
+        if (text.compare(0, 4, "tcp:") == 0 && atoi(text.c_str() + 4) > 0 && atoi(text.c_str() + 4) < 65536) {
+            sockaddr_in* tcp = (sockaddr_in*)&address;
+            tcp->sin_family = family = AF_INET;
+            tcp->sin_port = htons(atoi(text.c_str() + 4));
+            tcp->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            length = sizeof(sockaddr_in);
+            return true;
+        }
+        std::cout <<"ERROR: " <<text <<" is no server address (unix:/path or tcp:port)" <<std::endl;
+        return false;
+    }
+};
+
+// Send / receive exactly "size" bytes (false if the connection is closed)
+inline bool SocketSend(int socket, const void* data, ulong size) {
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    for (ulong done = 0; done < size; ) {
+        const ssize_t sent = send(socket, (const char*)data + done, size - done, flags);
+        if (sent <= 0) { return false; }
+        done += sent;
+    }
+    return true;
+}
+
+inline bool SocketReceive(int socket, void* data, ulong size) {
+    for (ulong done = 0; done < size; ) {
+        const ssize_t received = recv(socket, (char*)data + done, size - done, 0);
+        if (received <= 0) { return false; }
+        done += received;
+    }
+    return true;
+}
+
+inline void SocketOptions(int socket, int family) {
+    const int on = 1;
+#ifdef SO_NOSIGPIPE
+    setsockopt(socket, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    // Small requests and replies: do not wait for more data before sending
+    if (family == AF_INET) { setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); }
+}
+#endif
+
+
+template<typename T>
+class NetServer {
+private:
+    typedef std::chrono::steady_clock Clock;
+    
+    struct Request {
+        const byte* pixels;
+        Clock::time_point arrived;
+        NetServerReply* reply;
+        std::promise<void> done;
+    };
+    
+    struct Connection {
+        int socket;
+        bool finished;
+        std::thread thread;
+    };
+    
+    const NeuralNetVecT<T>& _net;
+    const long _maxBatch;
+    const long _maxWait;
+    const long _workerCount;
+    const ulong _imageSize;
+    std::string _address;
+    int _listener;
+    bool _running;                          // Accepting / serving connections
+    bool _working;                          // Workers running (until the last connection is closed)
+    
+    std::mutex _mutex;                      // Queue, stats and connections
+    std::condition_variable _queued;
+    std::deque<Request*> _queue;
+    std::vector<std::thread> _workers;
+    std::thread _acceptor;
+    std::list<Connection> _connections;
+    long _openConnections;
+    long _inFlight;                         // Images taken by the workers (not answered yet)
+    
+    Clock::time_point _statsStart;
+    NetLatencyHistogram _latencies;
+    ulong _batches;
+    
+public:
+    // "net" has to stay unchanged while the server runs (the workers copy it on Start)
+    NetServer(const NeuralNetVecT<T>& net, long maxBatch = SERVER_MAX_BATCH, long maxWait = SERVER_MAX_WAIT, long workers = SERVER_WORKERS)
+    : _net(net), _maxBatch(std::max<long>(1, maxBatch)), _maxWait(std::max<long>(0, maxWait)),
+      _workerCount((workers > 0) ? workers : std::max<long>(1, std::thread::hardware_concurrency())),
+      _imageSize(net.layers().front()), _listener(-1), _running(false), _working(false),
+      _openConnections(0), _inFlight(0), _batches(0) { }
+    
+    ~NetServer() { Stop(); }
+    
+    NetServer(const NetServer&) = delete;
+    NetServer& operator=(const NetServer&) = delete;
+    
+    
+    // Listen on "unix:/path" or "tcp:port" and serve in the background until Stop()
+    bool Start(const std::string& address) {
+#if WINDOWS
+        std::cout <<"ERROR: The inference server needs POSIX sockets" <<std::endl;
+        return false;
+#else
+        if (_running) { return false; }
+        if (_net.layers().back() != MNIST_CLASSES) {
+            std::cout <<"ERROR: The server needs a net with " <<MNIST_CLASSES <<" output neurons" <<std::endl;
+            return false;
+        }
+        NetSocketAddress socketAddress;
+        if (!socketAddress.Parse(address)) { return false; }
+        if (socketAddress.family == AF_UNIX) { unlink(((sockaddr_un*)&socketAddress.address)->sun_path); }
+        _listener = socket(socketAddress.family, SOCK_STREAM, 0);
+        const int on = 1;
+        if (_listener >= 0) { setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)); }
+        if (_listener < 0 || bind(_listener, (const sockaddr*)&socketAddress.address, socketAddress.length) != 0
+            || listen(_listener, SERVER_BACKLOG) != 0) {
+            std::cout <<"ERROR: Listening on " <<address <<std::endl;
+            if (_listener >= 0) { close(_listener); }
+            _listener = -1;
+            return false;
+        }
+        _address = address;
+        _running = _working = true;
+        ResetStats();
+        for (long w = 0; w < _workerCount; w++) { _workers.push_back(std::thread(&NetServer::Work, this, _net.Snapshot())); }
+        _acceptor = std::thread(&NetServer::Accept, this, socketAddress.family);
+        return true;
+#endif
+    }
+    
+    
+    // Close the listener and all connections, finish the queued requests
+    void Stop() {
+#if !WINDOWS
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_running) { return; }
+            _running = false;
+            for (Connection& c : _connections) {
+                if (!c.finished) { shutdown(c.socket, SHUT_RDWR); }
+            }
+        }
+        shutdown(_listener, SHUT_RDWR);
+        close(_listener);
+        _acceptor.join();
+        // (The workers answer the last requests of the connections)
+        for (Connection& c : _connections) { c.thread.join(); }
+        _connections.clear();
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _working = false;
+        }
+        _queued.notify_all();
+        for (std::thread& w : _workers) { w.join(); }
+        _workers.clear();
+        if (_address.compare(0, 5, "unix:") == 0) { unlink(_address.c_str() + 5); }
+#endif
+    }
+    
+    
+    NetServerStats Stats() {
+        // (Only the fixed size histogram is copied under the lock)
+        std::unique_lock<std::mutex> lock(_mutex);
+        const NetLatencyHistogram latencies = _latencies;
+        NetServerStats stats;
+        stats.batches = _batches;
+        stats.seconds = std::chrono::duration<double>(Clock::now() - _statsStart).count();
+        lock.unlock();
+        stats.requests = latencies.total;
+        stats.requestsPerSec = (stats.seconds > 0.0) ? stats.requests / stats.seconds : 0.0;
+        stats.meanBatch = stats.batches ? (double)stats.requests / stats.batches : 0.0;
+        stats.p50 = latencies.Percentile(0.5);
+        stats.p99 = latencies.Percentile(0.99);
+        stats.max = latencies.max;
+        return stats;
+    }
+    
+    void ResetStats() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _latencies.Clear();
+        _batches = 0;
+        _statsStart = Clock::now();
+    }
+    
+private:
+#if !WINDOWS
+    void Accept(int family) {
+        for (;;) {
+            const int client = accept(_listener, nullptr, nullptr);
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_running) {
+                if (client >= 0) { close(client); }
+                return;
+            }
+            if (client < 0) { continue; }
+            // Join the threads of closed connections
+            for (auto c = _connections.begin(); c != _connections.end(); ) {
+                if (!c->finished) { ++c; continue; }
+                c->thread.join();
+                c = _connections.erase(c);
+            }
+            SocketOptions(client, family);
+            _openConnections++;
+            _connections.push_back(Connection{client, false, std::thread()});
+            _connections.back().thread = std::thread(&NetServer::Serve, this, &_connections.back());
+        }
+    }
+    
+    
+    // One connection: read an image, queue it, send the reply when its batch is done
+    void Serve(Connection* connection) {
+        const int client = connection->socket;
+        std::vector<byte> pixels(_imageSize);
+        NetServerReply reply;
+        while (SocketReceive(client, pixels.data(), _imageSize)) {
+            Request request;
+            request.pixels = pixels.data();
+            request.arrived = Clock::now();
+            request.reply = &reply;
+            std::future<void> done = request.done.get_future();
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _queue.push_back(&request);
+            }
+            _queued.notify_one();
+            done.wait();
+            if (!SocketSend(client, &reply, sizeof(reply))) { break; }
+        }
+        {
+            // (Stop only shuts down the sockets of unfinished connections)
+            std::unique_lock<std::mutex> lock(_mutex);
+            connection->finished = true;
+            _openConnections--;
+        }
+        // (A waiting batch may be complete now)
+        _queued.notify_all();
+        close(client);
+    }
+#endif
+    
+    
+    // Worker: take up to "_maxBatch" queued images (waiting at most "_maxWait" for the batch to fill) and feed them forward
+    void Work(std::shared_ptr<NeuralNetVecT<T>> net) {
+        std::vector<T> input(_maxBatch * _imageSize);
+        std::vector<Request*> batch;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _queued.wait(lock, [this]() { return !_queue.empty() || !_working; });
+                if (_queue.empty()) { return; }
+                const Clock::time_point deadline = _queue.front()->arrived + std::chrono::microseconds(_maxWait);
+                while (_working && (long)_queue.size() < _maxBatch && (long)_queue.size() + _inFlight < _openConnections
+                       && _queued.wait_until(lock, deadline) != std::cv_status::timeout) { }
+                if (_queue.empty()) { continue; }   // Taken by an other worker in the meantime
+                const long count = std::min<long>(_maxBatch, _queue.size());
+                batch.assign(_queue.begin(), _queue.begin() + count);
+                _queue.erase(_queue.begin(), _queue.begin() + count);
+                _inFlight += count;
+            }
+            // Images left in the queue: wake the next worker
+            _queued.notify_one();
+            
+            const long count = batch.size();
+            for (long b = 0; b < count; b++) {
+                Simd<T>().ConvertBytes(batch[b]->pixels, (T)(1.0 / 255), input.data() + b * _imageSize, _imageSize);
+            }
+            const std::vector<T> output = net->FeedForward(input, count);
+            const Clock::time_point finished = Clock::now();
+            std::unique_lock<std::mutex> lock(_mutex);
+            _batches++;
+            _inFlight -= count;
+            for (long b = 0; b < count; b++) {
+                const T* o = output.data() + b * MNIST_CLASSES;
+                NetServerReply& reply = *batch[b]->reply;
+                reply.label = std::max_element(o, o + MNIST_CLASSES) - o;
+                std::copy(o, o + MNIST_CLASSES, reply.outputs);
+                _latencies.Add(std::chrono::duration<double, std::micro>(finished - batch[b]->arrived).count());
+                batch[b]->done.set_value();
+            }
+        }
+    }
+};
+
+
+// Client of a NetServer: one image at a time per client (use one client per thread for concurrent requests)
+class NetServerClient {
+private:
+    int _socket;
+    
+public:
+    NetServerClient() : _socket(-1) { }
+    ~NetServerClient() { Close(); }
+    
+    NetServerClient(const NetServerClient&) = delete;
+    NetServerClient& operator=(const NetServerClient&) = delete;
+    
+    bool Connect(const std::string& address) {
+#if WINDOWS
+        std::cout <<"ERROR: The inference server needs POSIX sockets" <<std::endl;
+        return false;
+#else
+        Close();
+        NetSocketAddress socketAddress;
+        if (!socketAddress.Parse(address)) { return false; }
+        _socket = socket(socketAddress.family, SOCK_STREAM, 0);
+        if (_socket < 0 || connect(_socket, (const sockaddr*)&socketAddress.address, socketAddress.length) != 0) {
+            std::cout <<"ERROR: Connecting to " <<address <<std::endl;
+            Close();
+            return false;
+        }
+        SocketOptions(_socket, socketAddress.family);
+        return true;
+#endif
+    }
+    
+    // Send an image (imageSize bytes) and wait for the reply
+    bool Classify(const byte* pixels, ulong imageSize, NetServerReply& reply) {
+#if WINDOWS
+        return false;
+#else
+        return _socket >= 0 && SocketSend(_socket, pixels, imageSize) && SocketReceive(_socket, &reply, sizeof(reply));
+#endif
+    }
+    
+    void Close() {
+#if !WINDOWS
+        if (_socket >= 0) { close(_socket); }
+#endif
+        _socket = -1;
+    }
+};
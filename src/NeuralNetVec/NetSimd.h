@@ -0,0 +1,560 @@
+//  NetSimd.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include "../NetBase.h"
+
+// SIMD building blocks for the NetMath.h kernels. Every instruction set gets its own
+// compiled copy of the kernels in NetSimdKernels.h and the best one the CPU supports
+// is picked once at runtime, so a single binary runs SSE2, AVX2 or AVX-512 code.
+// The kernels exist for double and float (twice the values per register). The scalar
+// kernels are the reference implementation and the fallback for every other architecture
+// (ARM, or x86 without SSE2).
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define SIMD_X86                true
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#else
+    #define SIMD_X86                false
+#endif
+
+// Weight matrix tile (rows x columns) that is reused for all the samples of a batch
+// (32 x 256 doubles = 64 KB, fits into the L2 cache next to the value tiles)
+#define SIMD_ROW_TILE               32
+#define SIMD_COLUMN_TILE            256
+
+enum class SimdLevel { Scalar, SSE2, AVX2, AVX512 };
+
+
+// Function table of one instruction set (T = double or float)
+template<typename T>
+struct SimdKernelsT {
+    SimdLevel level;
+    const char* name;
+    // Dot product of two vectors with n elements
+    T (*Dot)(const T* a, const T* b, long n);
+    // Register blocked dot product of 4 matrix rows (stride apart) with one vector: out[0..3] += rows.x
+    void (*Dot4)(const T* rows, long stride, const T* x, long n, T* out);
+    // y += a * x
+    void (*Axpy)(T a, const T* x, T* y, long n);
+    // Register blocked y += a[0..3] * 4 matrix rows (stride apart), y is loaded and stored once
+    void (*Axpy4)(const T* a, const T* rows, long stride, T* y, long n);
+    // out = scale * in (bulk conversion of 8-Bit data, e.g. pixels, to T)
+    void (*ConvertBytes)(const byte* in, T scale, T* out, long n);
+    // Fused optimizer steps on n weights w with the gradient g = gradientScale * gradient (see NetOptimizer.h),
+    // every weight and its state is read and written once
+    //   Momentum:  delta = momentum * delta - learnRate * g,  w += delta
+    //   Nesterov:  delta = momentum * delta - learnRate * g,  w += momentum * delta - learnRate * g
+    //   Adam:      m = beta1 * m + (1 - beta1) * g,  v = beta2 * v + (1 - beta2) * g^2,  w -= learnRate * m / (sqrt(v) + epsilon)
+    void (*MomentumStep)(const T* gradient, T gradientScale, T* w, T* delta, long n, T learnRate, T momentum);
+    void (*NesterovStep)(const T* gradient, T gradientScale, T* w, T* delta, long n, T learnRate, T momentum);
+    void (*AdamStep)(const T* gradient, T gradientScale, T* w, T* m, T* v, long n, T learnRate, T beta1, T beta2, T epsilon);
+    // Activation functions in place on n values with the polynomial exp (see FastExp and NetActivation.h)
+    void (*Exp)(T* x, long n);
+    void (*Sigmoid)(T* x, long n);                  // 1 / (1 + e^-x)
+    void (*Tanh)(T* x, long n);                     // 2 / (1 + e^-2x) - 1
+    void (*ReLU)(T* x, long n, T slope);            // max(x, slope * x) (slope 0 = ReLU, 0 < slope < 1 = leaky ReLU)
+};
+
+typedef SimdKernelsT<double> SimdKernels;
+
+
+// Polynomial exp of the activation kernels:  e^x = 2^n * e^f  with  n = round(x / ln2),  f = x - n * ln2
+// (ln2 split in two parts, so f is exact) and e^f as the degree 7 Taylor polynomial on |f| <= ln2 / 2.
+// Relative error: (ln2 / 2)^8 / 8! * e^(ln2 / 2) < 7.5e-9 plus the rounding of T, so the float version
+// is as exact as libm. x is clamped to [SimdExpRange<T>::Min, Max] (no infinity / denormal results)
+#define SIMD_LOG2E                  1.44269504088896340736
+#define SIMD_LN2_HI                 0.693145751953125           // (Upper bits of ln2, n * SIMD_LN2_HI is exact)
+#define SIMD_LN2_LO                 1.42860682030941723212e-6
+#define SIMD_EXP_DEGREE             7
+static const double SimdExpCoefficients[SIMD_EXP_DEGREE + 1] = { 1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040 };
+
+template<typename T> struct SimdExpRange;
+template<> struct SimdExpRange<double> { static constexpr double Min = -708.0, Max = 709.0; };
+template<> struct SimdExpRange<float> { static constexpr float Min = -87.0f, Max = 88.0f; };
+
+
+// Scalar reference kernels
+namespace scalar {
+    template<typename T>
+    inline T FastExp(T x) {
+        x = (x < SimdExpRange<T>::Min) ? SimdExpRange<T>::Min : ((x > SimdExpRange<T>::Max) ? SimdExpRange<T>::Max : x);
+        const T n = nearbyint(x * (T)SIMD_LOG2E);
+        const T f = (x - n * (T)SIMD_LN2_HI) - n * (T)SIMD_LN2_LO;
+        T p = (T)SimdExpCoefficients[SIMD_EXP_DEGREE];
+        for (long k = SIMD_EXP_DEGREE - 1; k >= 0; k--) { p = p * f + (T)SimdExpCoefficients[k]; }
+        return ldexp(p, (int)n);
+    }
+
+    template<typename T>
+    T Dot(const T* a, const T* b, long n) {
+        T sum = 0;
+        for (long i = 0; i < n; i++) { sum += (a[i] * b[i]); }
+        return sum;
+    }
+
+    template<typename T>
+    void Dot4(const T* rows, long stride, const T* x, long n, T* out) {
+        for (long r = 0; r < 4; r++) { out[r] += Dot(rows + r * stride, x, n); }
+    }
+
+    template<typename T>
+    void Axpy(T a, const T* x, T* y, long n) {
+        for (long i = 0; i < n; i++) { y[i] += (a * x[i]); }
+    }
+
+    template<typename T>
+    void Axpy4(const T* a, const T* rows, long stride, T* y, long n) {
+        for (long r = 0; r < 4; r++) { Axpy(a[r], rows + r * stride, y, n); }
+    }
+
+    template<typename T>
+    void ConvertBytes(const byte* in, T scale, T* out, long n) {
+        for (long i = 0; i < n; i++) { out[i] = (scale * in[i]); }
+    }
+
+    template<typename T>
+    void MomentumStep(const T* gradient, T gradientScale, T* w, T* delta, long n, T learnRate, T momentum) {
+        for (long i = 0; i < n; i++) {
+            delta[i] = (momentum * delta[i]) - (learnRate * gradientScale * gradient[i]);
+            w[i] += delta[i];
+        }
+    }
+
+    template<typename T>
+    void NesterovStep(const T* gradient, T gradientScale, T* w, T* delta, long n, T learnRate, T momentum) {
+        for (long i = 0; i < n; i++) {
+            const T step = learnRate * gradientScale * gradient[i];
+            delta[i] = (momentum * delta[i]) - step;
+            w[i] += (momentum * delta[i]) - step;
+        }
+    }
+
+    template<typename T>
+    void AdamStep(const T* gradient, T gradientScale, T* w, T* m, T* v, long n, T learnRate, T beta1, T beta2, T epsilon) {
+        for (long i = 0; i < n; i++) {
+            const T g = gradientScale * gradient[i];
+            m[i] = (beta1 * m[i]) + ((1 - beta1) * g);
+            v[i] = (beta2 * v[i]) + ((1 - beta2) * g * g);
+            w[i] -= (learnRate * m[i]) / (sqrt(v[i]) + epsilon);
+        }
+    }
+
+    template<typename T>
+    void Exp(T* x, long n) {
+        for (long i = 0; i < n; i++) { x[i] = FastExp(x[i]); }
+    }
+
+    template<typename T>
+    void Sigmoid(T* x, long n) {
+        for (long i = 0; i < n; i++) { x[i] = 1 / (1 + FastExp(-x[i])); }
+    }
+
+    template<typename T>
+    void Tanh(T* x, long n) {
+        for (long i = 0; i < n; i++) { x[i] = 2 / (1 + FastExp(-2 * x[i])) - 1; }
+    }
+
+    template<typename T>
+    void ReLU(T* x, long n, T slope) {
+        for (long i = 0; i < n; i++) { x[i] = std::max(x[i], slope * x[i]); }
+    }
+}
+
+
+#if SIMD_X86
+
+// Each instruction set wraps its registers in a "SimdRegF64" (double) and a "SimdRegF32" (float) struct
+// and includes the generic kernels once for each of them.
+// GCC and Clang need the target attributes to compile the intrinsics without global -m flags
+// (MSVC compiles all intrinsics by default). The AVX kernels clear the upper register halves
+// before returning (ZeroUpper), because the calling code (libm exp, memset, ...) may run
+// legacy SSE instructions and would pay the AVX-SSE transition penalty otherwise (GCC -Os
+// does not insert the vzeroupper on its own).
+
+// SSE2 (2 doubles / 4 floats per register, no FMA)
+#if defined(__clang__)
+    #pragma clang attribute push (__attribute__((target("sse2"))), apply_to = function)
+#elif defined(__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC target("sse2")
+#endif
+namespace sse2 {
+    struct SimdRegF64 {
+        typedef double Real;
+        typedef __m128d Reg;
+        static const long Width = 2;
+        static inline Reg Zero() { return _mm_setzero_pd(); }
+        static inline Reg Set(double x) { return _mm_set1_pd(x); }
+        static inline Reg Load(const double* p) { return _mm_loadu_pd(p); }
+        static inline void Store(double* p, Reg r) { _mm_storeu_pd(p, r); }
+        static inline Reg LoadBytes(const byte* p) {
+            // Zero extend 2 bytes to 32-Bit integers (SSE2 has no pmovzx)
+            const __m128i zero = _mm_setzero_si128();
+            const __m128i bytes = _mm_cvtsi32_si128(p[0] | (p[1] << 8));
+            return _mm_cvtepi32_pd(_mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero));
+        }
+        static inline Reg Add(Reg a, Reg b) { return _mm_add_pd(a, b); }
+        static inline Reg Mul(Reg a, Reg b) { return _mm_mul_pd(a, b); }
+        static inline Reg Sub(Reg a, Reg b) { return _mm_sub_pd(a, b); }
+        static inline Reg Div(Reg a, Reg b) { return _mm_div_pd(a, b); }
+        static inline Reg Sqrt(Reg a) { return _mm_sqrt_pd(a); }
+        static inline Reg Min(Reg a, Reg b) { return _mm_min_pd(a, b); }
+        static inline Reg Max(Reg a, Reg b) { return _mm_max_pd(a, b); }
+        static inline Reg Round(Reg a) { return _mm_cvtepi32_pd(_mm_cvtpd_epi32(a)); }
+        static inline Reg Ldexp(Reg a, Reg n) {
+            // 2^n from the exponent bits: (n + 1023) << 20 in the upper 32 Bit of each double
+            const __m128i e = _mm_add_epi32(_mm_shuffle_epi32(_mm_cvtpd_epi32(n), _MM_SHUFFLE(1, 1, 0, 0)), _mm_set1_epi32(1023));
+            return _mm_mul_pd(a, _mm_castsi128_pd(_mm_and_si128(_mm_slli_epi32(e, 20), _mm_set_epi32(-1, 0, -1, 0))));
+        }
+        static inline Reg MulAdd(Reg a, Reg b, Reg c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+        static inline double Sum(Reg r) { return _mm_cvtsd_f64(_mm_add_sd(r, _mm_unpackhi_pd(r, r))); }
+        static inline void ZeroUpper() { }
+    };
+
+    struct SimdRegF32 {
+        typedef float Real;
+        typedef __m128 Reg;
+        static const long Width = 4;
+        static inline Reg Zero() { return _mm_setzero_ps(); }
+        static inline Reg Set(float x) { return _mm_set1_ps(x); }
+        static inline Reg Load(const float* p) { return _mm_loadu_ps(p); }
+        static inline void Store(float* p, Reg r) { _mm_storeu_ps(p, r); }
+        static inline Reg LoadBytes(const byte* p) {
+            int bytes;
+            memcpy(&bytes, p, sizeof(bytes));
+            const __m128i zero = _mm_setzero_si128();
+            return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero));
+        }
+        static inline Reg Add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+        static inline Reg Mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+        static inline Reg Sub(Reg a, Reg b) { return _mm_sub_ps(a, b); }
+        static inline Reg Div(Reg a, Reg b) { return _mm_div_ps(a, b); }
+        static inline Reg Sqrt(Reg a) { return _mm_sqrt_ps(a); }
+        static inline Reg Min(Reg a, Reg b) { return _mm_min_ps(a, b); }
+        static inline Reg Max(Reg a, Reg b) { return _mm_max_ps(a, b); }
+        static inline Reg Round(Reg a) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(a)); }
+        static inline Reg Ldexp(Reg a, Reg n) {
+            return _mm_mul_ps(a, _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23)));
+        }
+        static inline Reg MulAdd(Reg a, Reg b, Reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+        static inline float Sum(Reg r) {
+            const __m128 s = _mm_add_ps(r, _mm_movehl_ps(r, r));
+            return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+        }
+        static inline void ZeroUpper() { }
+    };
+}
+#define SIMD_NAMESPACE sse2
+#define SIMD_PRECISION f64
+#define SIMD_REGISTER SimdRegF64
+#include "NetSimdKernels.h"
+#undef SIMD_PRECISION
+#undef SIMD_REGISTER
+#define SIMD_PRECISION f32
+#define SIMD_REGISTER SimdRegF32
+#include "NetSimdKernels.h"
+#undef SIMD_PRECISION
+#undef SIMD_REGISTER
+#undef SIMD_NAMESPACE
+#if defined(__clang__)
+    #pragma clang attribute pop
+#elif defined(__GNUC__)
+    #pragma GCC pop_options
+#endif
+
+
+// AVX2 + FMA (4 doubles / 8 floats per register: Haswell, Zen and newer)
+#if defined(__clang__)
+    #pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC target("avx2,fma")
+#endif
+namespace avx2 {
+    struct SimdRegF64 {
+        typedef double Real;
+        typedef __m256d Reg;
+        static const long Width = 4;
+        static inline Reg Zero() { return _mm256_setzero_pd(); }
+        static inline Reg Set(double x) { return _mm256_set1_pd(x); }
+        static inline Reg Load(const double* p) { return _mm256_loadu_pd(p); }
+        static inline void Store(double* p, Reg r) { _mm256_storeu_pd(p, r); }
+        static inline Reg LoadBytes(const byte* p) {
+            int bytes;
+            memcpy(&bytes, p, sizeof(bytes));
+            return _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+        }
+        static inline Reg Add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+        static inline Reg Mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+        static inline Reg Sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+        static inline Reg Div(Reg a, Reg b) { return _mm256_div_pd(a, b); }
+        static inline Reg Sqrt(Reg a) { return _mm256_sqrt_pd(a); }
+        static inline Reg Min(Reg a, Reg b) { return _mm256_min_pd(a, b); }
+        static inline Reg Max(Reg a, Reg b) { return _mm256_max_pd(a, b); }
+        static inline Reg Round(Reg a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+        static inline Reg Ldexp(Reg a, Reg n) {
+            const __m256i e = _mm256_add_epi64(_mm256_cvtepi32_epi64(_mm256_cvtpd_epi32(n)), _mm256_set1_epi64x(1023));
+            return _mm256_mul_pd(a, _mm256_castsi256_pd(_mm256_slli_epi64(e, 52)));
+        }
+        static inline Reg MulAdd(Reg a, Reg b, Reg c) { return _mm256_fmadd_pd(a, b, c); }
+        static inline double Sum(Reg r) {
+            __m128d s = _mm_add_pd(_mm256_castpd256_pd128(r), _mm256_extractf128_pd(r, 1));
+            return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+        }
+        static inline void ZeroUpper() { _mm256_zeroupper(); }
+    };
+
+    struct SimdRegF32 {
+        typedef float Real;
+        typedef __m256 Reg;
+        static const long Width = 8;
+        static inline Reg Zero() { return _mm256_setzero_ps(); }
+        static inline Reg Set(float x) { return _mm256_set1_ps(x); }
+        static inline Reg Load(const float* p) { return _mm256_loadu_ps(p); }
+        static inline void Store(float* p, Reg r) { _mm256_storeu_ps(p, r); }
+        static inline Reg LoadBytes(const byte* p) {
+            return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p)));
+        }
+        static inline Reg Add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+        static inline Reg Mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+        static inline Reg Sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+        static inline Reg Div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+        static inline Reg Sqrt(Reg a) { return _mm256_sqrt_ps(a); }
+        static inline Reg Min(Reg a, Reg b) { return _mm256_min_ps(a, b); }
+        static inline Reg Max(Reg a, Reg b) { return _mm256_max_ps(a, b); }
+        static inline Reg Round(Reg a) { return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+        static inline Reg Ldexp(Reg a, Reg n) {
+            const __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127));
+            return _mm256_mul_ps(a, _mm256_castsi256_ps(_mm256_slli_epi32(e, 23)));
+        }
+        static inline Reg MulAdd(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+        static inline float Sum(Reg r) {
+            __m128 s = _mm_add_ps(_mm256_castps256_ps128(r), _mm256_extractf128_ps(r, 1));
+            s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+            return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+        }
+        static inline void ZeroUpper() { _mm256_zeroupper(); }
+    };
+}
+#define SIMD_NAMESPACE avx2
+#define SIMD_PRECISION f64
+#define SIMD_REGISTER SimdRegF64
+#include "NetSimdKernels.h"
+#undef SIMD_PRECISION
+#undef SIMD_REGISTER
+#define SIMD_PRECISION f32
+#define SIMD_REGISTER SimdRegF32
+#include "NetSimdKernels.h"
+#undef SIMD_PRECISION
+#undef SIMD_REGISTER
+#undef SIMD_NAMESPACE
+#if defined(__clang__)
+    #pragma clang attribute pop
+#elif defined(__GNUC__)
+    #pragma GCC pop_options
+#endif
+
+
+// AVX-512F (8 doubles / 16 floats per register: Skylake-SP, Ice Lake, Zen 4 and newer)
+#if defined(__clang__)
+    #pragma clang attribute push (__attribute__((target("avx512f"))), apply_to = function)
+#elif defined(__GNUC__)
+    #pragma GCC push_options
+    #pragma GCC target("avx512f")
+#endif
+namespace avx512 {
+    struct SimdRegF64 {
+        typedef double Real;
+        typedef __m512d Reg;
+        static const long Width = 8;
+        static inline Reg Zero() { return _mm512_setzero_pd(); }
+        static inline Reg Set(double x) { return _mm512_set1_pd(x); }
+        static inline Reg Load(const double* p) { return _mm512_loadu_pd(p); }
+        static inline void Store(double* p, Reg r) { _mm512_storeu_pd(p, r); }
+        static inline Reg LoadBytes(const byte* p) {
+            // (maskz: the unmasked intrinsic trips -Wuninitialized in GCC 12 headers as well)
+            return _mm512_maskz_cvtepi32_pd(0xFF, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p)));
+        }
+        static inline Reg Add(Reg a, Reg b) { return _mm512_add_pd(a, b); }
+        static inline Reg Mul(Reg a, Reg b) { return _mm512_mul_pd(a, b); }
+        static inline Reg Sub(Reg a, Reg b) { return _mm512_sub_pd(a, b); }
+        static inline Reg Div(Reg a, Reg b) { return _mm512_div_pd(a, b); }
+        static inline Reg Sqrt(Reg a) { return _mm512_maskz_sqrt_pd(0xFF, a); }
+        static inline Reg Min(Reg a, Reg b) { return _mm512_maskz_min_pd(0xFF, a, b); }
+        static inline Reg Max(Reg a, Reg b) { return _mm512_maskz_max_pd(0xFF, a, b); }
+        static inline Reg Round(Reg a) { return _mm512_maskz_roundscale_pd(0xFF, a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+        static inline Reg Ldexp(Reg a, Reg n) { return _mm512_maskz_scalef_pd(0xFF, a, n); }
+        static inline Reg MulAdd(Reg a, Reg b, Reg c) { return _mm512_fmadd_pd(a, b, c); }
+        static inline double Sum(Reg r) {
+            // (Through memory: the 512 -> 256 bit extract intrinsics trip -Wuninitialized in GCC 12 headers)
+            alignas(64) double lanes[8];
+            _mm512_store_pd(lanes, r);
+            return ((lanes[0] + lanes[4]) + (lanes[2] + lanes[6])) + ((lanes[1] + lanes[5]) + (lanes[3] + lanes[7]));
+        }
+        static inline void ZeroUpper() { _mm256_zeroupper(); }
+    };
+
+    struct SimdRegF32 {
+        typedef float Real;
+        typedef __m512 Reg;
+        static const long Width = 16;
+        static inline Reg Zero() { return _mm512_setzero_ps(); }
+        static inline Reg Set(float x) { return _mm512_set1_ps(x); }
+        static inline Reg Load(const float* p) { return _mm512_loadu_ps(p); }
+        static inline void Store(float* p, Reg r) { _mm512_storeu_ps(p, r); }
+        static inline Reg LoadBytes(const byte* p) {
+            return _mm512_maskz_cvtepi32_ps(0xFFFF, _mm512_maskz_cvtepu8_epi32(0xFFFF, _mm_loadu_si128((const __m128i*)p)));
+        }
+        static inline Reg Add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+        static inline Reg Mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+        static inline Reg Sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+        static inline Reg Div(Reg a, Reg b) { return _mm512_div_ps(a, b); }
+        static inline Reg Sqrt(Reg a) { return _mm512_maskz_sqrt_ps(0xFFFF, a); }
+        static inline Reg Min(Reg a, Reg b) { return _mm512_maskz_min_ps(0xFFFF, a, b); }
+        static inline Reg Max(Reg a, Reg b) { return _mm512_maskz_max_ps(0xFFFF, a, b); }
+        static inline Reg Round(Reg a) { return _mm512_maskz_roundscale_ps(0xFFFF, a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+        static inline Reg Ldexp(Reg a, Reg n) { return _mm512_maskz_scalef_ps(0xFFFF, a, n); }
+        static inline Reg MulAdd(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); }
+        static inline float Sum(Reg r) {
+            alignas(64) float lanes[16];
+            _mm512_store_ps(lanes, r);
+            float sum = 0.0f;
+            for (long i = 0; i < 8; i++) { sum += (lanes[i] + lanes[i + 8]); }
+            return sum;
+        }
+        static inline void ZeroUpper() { _mm256_zeroupper(); }
+    };
+}
+#define SIMD_NAMESPACE avx512
+#define SIMD_PRECISION f64
+#define SIMD_REGISTER SimdRegF64
+#include "NetSimdKernels.h"
+#undef SIMD_PRECISION
+#undef SIMD_REGISTER
+#define SIMD_PRECISION f32
+#define SIMD_REGISTER SimdRegF32
+#include "NetSimdKernels.h"
+#undef SIMD_PRECISION
+#undef SIMD_REGISTER
+#undef SIMD_NAMESPACE
+#if defined(__clang__)
+    #pragma clang attribute pop
+#elif defined(__GNUC__)
+    #pragma GCC pop_options
+#endif
+
+#endif // SIMD_X86
+
+
+// Get the best instruction set this CPU (and OS) supports
+SimdLevel DetectSimdLevel() {
+#if SIMD_X86
+    #if defined(_MSC_VER)
+        int info[4] = {0};
+        __cpuid(info, 0);
+        const int maxLeaf = info[0];
+        __cpuid(info, 1);
+        const bool sse2 = (info[3] & (1 << 26)) != 0;
+        const bool fma = (info[2] & (1 << 12)) != 0;
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx2 = false, avx512 = false;
+        if (osxsave && maxLeaf >= 7) {
+            // The OS has to save the YMM (and ZMM) registers on context switches
+            const unsigned long long xcr0 = _xgetbv(0);
+            __cpuidex(info, 7, 0);
+            avx2 = fma && ((info[1] & (1 << 5)) != 0) && ((xcr0 & 0x06) == 0x06);
+            avx512 = ((info[1] & (1 << 16)) != 0) && ((xcr0 & 0xE6) == 0xE6);
+        }
+    #else
+        __builtin_cpu_init();
+        const bool sse2 = __builtin_cpu_supports("sse2");
+        const bool avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        const bool avx512 = __builtin_cpu_supports("avx512f");
+    #endif
+    if (avx512) { return SimdLevel::AVX512; }
+    if (avx2) { return SimdLevel::AVX2; }
+    if (sse2) { return SimdLevel::SSE2; }
+#endif
+    return SimdLevel::Scalar;
+}
+
+
+// Get the kernel table of an instruction set (falls back to scalar if it is not compiled in)
+template<typename T>
+const SimdKernelsT<T>& GetSimdKernels(SimdLevel level) {
+    static const SimdKernelsT<T> scalarKernels = { SimdLevel::Scalar, "Scalar", scalar::Dot<T>, scalar::Dot4<T>, scalar::Axpy<T>, scalar::Axpy4<T>, scalar::ConvertBytes<T>,
+                                                       scalar::MomentumStep<T>, scalar::NesterovStep<T>, scalar::AdamStep<T>,
+                                                       scalar::Exp<T>, scalar::Sigmoid<T>, scalar::Tanh<T>, scalar::ReLU<T> };
+#if SIMD_X86
+    static const SimdKernelsT<T> sse2Kernels = { SimdLevel::SSE2, "SSE2", sse2::Dot, sse2::Dot4, sse2::Axpy, sse2::Axpy4, sse2::ConvertBytes,
+                                                     sse2::MomentumStep, sse2::NesterovStep, sse2::AdamStep,
+                                                     sse2::Exp, sse2::Sigmoid, sse2::Tanh, sse2::ReLU };
+    static const SimdKernelsT<T> avx2Kernels = { SimdLevel::AVX2, "AVX2", avx2::Dot, avx2::Dot4, avx2::Axpy, avx2::Axpy4, avx2::ConvertBytes,
+                                                     avx2::MomentumStep, avx2::NesterovStep, avx2::AdamStep,
+                                                     avx2::Exp, avx2::Sigmoid, avx2::Tanh, avx2::ReLU };
+    static const SimdKernelsT<T> avx512Kernels = { SimdLevel::AVX512, "AVX-512", avx512::Dot, avx512::Dot4, avx512::Axpy, avx512::Axpy4, avx512::ConvertBytes,
+                                                     avx512::MomentumStep, avx512::NesterovStep, avx512::AdamStep,
+                                                     avx512::Exp, avx512::Sigmoid, avx512::Tanh, avx512::ReLU };
+    switch (level) {
+        case SimdLevel::SSE2:   return sse2Kernels;
+        case SimdLevel::AVX2:   return avx2Kernels;
+        case SimdLevel::AVX512: return avx512Kernels;
+        default: break;
+    }
+#endif
+    return scalarKernels;
+}
+
+
+// The kernels used by NetMath.h: Detected once on first use, can be forced
+// to a lower level (e.g. Scalar) to validate the results against the reference
+template<typename T>
+const SimdKernelsT<T>*& ActiveSimdKernels() {
+    static const SimdKernelsT<T>* active = &GetSimdKernels<T>(DetectSimdLevel());
+    return active;
+}
+
+template<typename T = double>
+inline const SimdKernelsT<T>& Simd() { return *ActiveSimdKernels<T>(); }
+
+void SetSimdLevel(SimdLevel level) {
+    // Never select an instruction set the CPU can not execute
+    if (level > DetectSimdLevel()) { level = DetectSimdLevel(); }
+    ActiveSimdKernels<double>() = &GetSimdKernels<double>(level);
+    ActiveSimdKernels<float>() = &GetSimdKernels<float>(level);
+}
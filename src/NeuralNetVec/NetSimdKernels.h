@@ -0,0 +1,276 @@
+//  NetSimdKernels.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+// No include guard: NetSimd.h includes this file once for every instruction set and precision,
+// with SIMD_NAMESPACE, SIMD_PRECISION (nested namespace) and SIMD_REGISTER (the register wrapper
+// of that set / precision) defined. The kernels of both precisions end up as overloads in SIMD_NAMESPACE.
+// Everything in here is compiled with the target attributes of the including region.
+
+namespace SIMD_NAMESPACE {
+namespace SIMD_PRECISION {
+
+    typedef SIMD_REGISTER SimdReg;
+    typedef SimdReg::Real Real;
+
+    Real Dot(const Real* a, const Real* b, long n) {
+        // Two independent accumulators to hide the add / fma latency
+        SimdReg::Reg s0 = SimdReg::Zero(), s1 = SimdReg::Zero();
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + 2 * W <= n; i += 2 * W) {
+            s0 = SimdReg::MulAdd(SimdReg::Load(a + i), SimdReg::Load(b + i), s0);
+            s1 = SimdReg::MulAdd(SimdReg::Load(a + i + W), SimdReg::Load(b + i + W), s1);
+        }
+        for (; i + W <= n; i += W) {
+            s0 = SimdReg::MulAdd(SimdReg::Load(a + i), SimdReg::Load(b + i), s0);
+        }
+        Real sum = SimdReg::Sum(SimdReg::Add(s0, s1));
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) { sum += (a[i] * b[i]); }
+        return sum;
+    }
+
+
+    void Dot4(const Real* rows, long stride, const Real* x, long n, Real* out) {
+        // Register blocking: every loaded value of x is used for 4 rows
+        const Real* r0 = rows;
+        const Real* r1 = rows + stride;
+        const Real* r2 = rows + 2 * stride;
+        const Real* r3 = rows + 3 * stride;
+        SimdReg::Reg s0 = SimdReg::Zero(), s1 = SimdReg::Zero(), s2 = SimdReg::Zero(), s3 = SimdReg::Zero();
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + W <= n; i += W) {
+            const SimdReg::Reg xv = SimdReg::Load(x + i);
+            s0 = SimdReg::MulAdd(SimdReg::Load(r0 + i), xv, s0);
+            s1 = SimdReg::MulAdd(SimdReg::Load(r1 + i), xv, s1);
+            s2 = SimdReg::MulAdd(SimdReg::Load(r2 + i), xv, s2);
+            s3 = SimdReg::MulAdd(SimdReg::Load(r3 + i), xv, s3);
+        }
+        Real d0 = SimdReg::Sum(s0), d1 = SimdReg::Sum(s1), d2 = SimdReg::Sum(s2), d3 = SimdReg::Sum(s3);
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) {
+            d0 += (r0[i] * x[i]);
+            d1 += (r1[i] * x[i]);
+            d2 += (r2[i] * x[i]);
+            d3 += (r3[i] * x[i]);
+        }
+        out[0] += d0;
+        out[1] += d1;
+        out[2] += d2;
+        out[3] += d3;
+    }
+
+
+    void Axpy(Real a, const Real* x, Real* y, long n) {
+        const SimdReg::Reg av = SimdReg::Set(a);
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + W <= n; i += W) {
+            SimdReg::Store(y + i, SimdReg::MulAdd(av, SimdReg::Load(x + i), SimdReg::Load(y + i)));
+        }
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) { y[i] += (a * x[i]); }
+    }
+
+
+    void Axpy4(const Real* a, const Real* rows, long stride, Real* y, long n) {
+        // Register blocking: every loaded / stored value of y takes the contribution of 4 rows
+        const Real* r0 = rows;
+        const Real* r1 = rows + stride;
+        const Real* r2 = rows + 2 * stride;
+        const Real* r3 = rows + 3 * stride;
+        const SimdReg::Reg a0 = SimdReg::Set(a[0]), a1 = SimdReg::Set(a[1]), a2 = SimdReg::Set(a[2]), a3 = SimdReg::Set(a[3]);
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + W <= n; i += W) {
+            SimdReg::Reg yv = SimdReg::Load(y + i);
+            yv = SimdReg::MulAdd(a0, SimdReg::Load(r0 + i), yv);
+            yv = SimdReg::MulAdd(a1, SimdReg::Load(r1 + i), yv);
+            yv = SimdReg::MulAdd(a2, SimdReg::Load(r2 + i), yv);
+            yv = SimdReg::MulAdd(a3, SimdReg::Load(r3 + i), yv);
+            SimdReg::Store(y + i, yv);
+        }
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) { y[i] += (a[0] * r0[i]) + (a[1] * r1[i]) + (a[2] * r2[i]) + (a[3] * r3[i]); }
+    }
+
+
+    void ConvertBytes(const byte* in, Real scale, Real* out, long n) {
+        const SimdReg::Reg sv = SimdReg::Set(scale);
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + W <= n; i += W) {
+            SimdReg::Store(out + i, SimdReg::Mul(SimdReg::LoadBytes(in + i), sv));
+        }
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) { out[i] = (scale * in[i]); }
+    }
+
+
+    void MomentumStep(const Real* gradient, Real gradientScale, Real* w, Real* delta, long n, Real learnRate, Real momentum) {
+        const Real step = learnRate * gradientScale;
+        const SimdReg::Reg sv = SimdReg::Set(step), mv = SimdReg::Set(momentum);
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + W <= n; i += W) {
+            const SimdReg::Reg d = SimdReg::Sub(SimdReg::Mul(mv, SimdReg::Load(delta + i)), SimdReg::Mul(sv, SimdReg::Load(gradient + i)));
+            SimdReg::Store(delta + i, d);
+            SimdReg::Store(w + i, SimdReg::Add(SimdReg::Load(w + i), d));
+        }
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) {
+            delta[i] = (momentum * delta[i]) - (step * gradient[i]);
+            w[i] += delta[i];
+        }
+    }
+
+
+    void NesterovStep(const Real* gradient, Real gradientScale, Real* w, Real* delta, long n, Real learnRate, Real momentum) {
+        // The weights move by the new delta and one more momentum step ahead (look ahead gradient)
+        const Real step = learnRate * gradientScale;
+        const SimdReg::Reg sv = SimdReg::Set(step), mv = SimdReg::Set(momentum);
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + W <= n; i += W) {
+            const SimdReg::Reg g = SimdReg::Mul(sv, SimdReg::Load(gradient + i));
+            const SimdReg::Reg d = SimdReg::Sub(SimdReg::Mul(mv, SimdReg::Load(delta + i)), g);
+            SimdReg::Store(delta + i, d);
+            SimdReg::Store(w + i, SimdReg::Add(SimdReg::Load(w + i), SimdReg::Sub(SimdReg::Mul(mv, d), g)));
+        }
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) {
+            const Real g = step * gradient[i];
+            delta[i] = (momentum * delta[i]) - g;
+            w[i] += (momentum * delta[i]) - g;
+        }
+    }
+
+
+    void AdamStep(const Real* gradient, Real gradientScale, Real* w, Real* m, Real* v, long n, Real learnRate, Real beta1, Real beta2, Real epsilon) {
+        const SimdReg::Reg gs = SimdReg::Set(gradientScale), lr = SimdReg::Set(learnRate), ev = SimdReg::Set(epsilon);
+        const SimdReg::Reg b1 = SimdReg::Set(beta1), b2 = SimdReg::Set(beta2), c1 = SimdReg::Set(1 - beta1), c2 = SimdReg::Set(1 - beta2);
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + W <= n; i += W) {
+            const SimdReg::Reg g = SimdReg::Mul(gs, SimdReg::Load(gradient + i));
+            const SimdReg::Reg mi = SimdReg::Add(SimdReg::Mul(b1, SimdReg::Load(m + i)), SimdReg::Mul(c1, g));
+            const SimdReg::Reg vi = SimdReg::Add(SimdReg::Mul(b2, SimdReg::Load(v + i)), SimdReg::Mul(c2, SimdReg::Mul(g, g)));
+            SimdReg::Store(m + i, mi);
+            SimdReg::Store(v + i, vi);
+            const SimdReg::Reg step = SimdReg::Div(SimdReg::Mul(lr, mi), SimdReg::Add(SimdReg::Sqrt(vi), ev));
+            SimdReg::Store(w + i, SimdReg::Sub(SimdReg::Load(w + i), step));
+        }
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) {
+            const Real g = gradientScale * gradient[i];
+            m[i] = (beta1 * m[i]) + ((1 - beta1) * g);
+            v[i] = (beta2 * v[i]) + ((1 - beta2) * g * g);
+            w[i] -= (learnRate * m[i]) / (sqrt(v[i]) + epsilon);
+        }
+    }
+
+
+    // Polynomial exp of a register (see FastExp in NetSimd.h)
+    inline SimdReg::Reg ExpReg(SimdReg::Reg x) {
+        x = SimdReg::Min(SimdReg::Max(x, SimdReg::Set(SimdExpRange<Real>::Min)), SimdReg::Set(SimdExpRange<Real>::Max));
+        const SimdReg::Reg n = SimdReg::Round(SimdReg::Mul(x, SimdReg::Set(SIMD_LOG2E)));
+        const SimdReg::Reg f = SimdReg::Sub(SimdReg::Sub(x, SimdReg::Mul(n, SimdReg::Set(SIMD_LN2_HI))), SimdReg::Mul(n, SimdReg::Set(SIMD_LN2_LO)));
+        SimdReg::Reg p = SimdReg::Set(SimdExpCoefficients[SIMD_EXP_DEGREE]);
+        for (long k = SIMD_EXP_DEGREE - 1; k >= 0; k--) { p = SimdReg::MulAdd(p, f, SimdReg::Set(SimdExpCoefficients[k])); }
+        return SimdReg::Ldexp(p, n);
+    }
+
+
+    void Exp(Real* x, long n) {
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + W <= n; i += W) { SimdReg::Store(x + i, ExpReg(SimdReg::Load(x + i))); }
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) { x[i] = scalar::FastExp(x[i]); }
+    }
+
+
+    void Sigmoid(Real* x, long n) {
+        const SimdReg::Reg one = SimdReg::Set(1), minusOne = SimdReg::Set(-1);
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + W <= n; i += W) {
+            const SimdReg::Reg e = ExpReg(SimdReg::Mul(minusOne, SimdReg::Load(x + i)));
+            SimdReg::Store(x + i, SimdReg::Div(one, SimdReg::Add(one, e)));
+        }
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) { x[i] = 1 / (1 + scalar::FastExp(-x[i])); }
+    }
+
+
+    void Tanh(Real* x, long n) {
+        // tanh(x) = 2 * sigmoid(2x) - 1 (one exp, saturates to -1 / 1 like the sigmoid)
+        const SimdReg::Reg one = SimdReg::Set(1), two = SimdReg::Set(2), minusTwo = SimdReg::Set(-2);
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + W <= n; i += W) {
+            const SimdReg::Reg e = ExpReg(SimdReg::Mul(minusTwo, SimdReg::Load(x + i)));
+            SimdReg::Store(x + i, SimdReg::Sub(SimdReg::Div(two, SimdReg::Add(one, e)), one));
+        }
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) { x[i] = 2 / (1 + scalar::FastExp(-2 * x[i])) - 1; }
+    }
+
+
+    void ReLU(Real* x, long n, Real slope) {
+        const SimdReg::Reg sv = SimdReg::Set(slope);
+        const long W = SimdReg::Width;
+        long i = 0;
+        for (; i + W <= n; i += W) {
+            const SimdReg::Reg v = SimdReg::Load(x + i);
+            SimdReg::Store(x + i, SimdReg::Max(v, SimdReg::Mul(sv, v)));
+        }
+        SimdReg::ZeroUpper();
+        for (; i < n; i++) { x[i] = std::max(x[i], slope * x[i]); }
+    }
+
+}
+
+    using SIMD_PRECISION::Dot;
+    using SIMD_PRECISION::Dot4;
+    using SIMD_PRECISION::Axpy;
+    using SIMD_PRECISION::Axpy4;
+    using SIMD_PRECISION::ConvertBytes;
+    using SIMD_PRECISION::MomentumStep;
+    using SIMD_PRECISION::NesterovStep;
+    using SIMD_PRECISION::AdamStep;
+    using SIMD_PRECISION::Exp;
+    using SIMD_PRECISION::Sigmoid;
+    using SIMD_PRECISION::Tanh;
+    using SIMD_PRECISION::ReLU;
+
+}
@@ -0,0 +1,131 @@
+//  NetThreadPool.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+#include "../NetBase.h"
+
+// Fixed set of worker threads that run "taskCount" tasks of one job and block the caller
+// until all of them are done. The calling thread works on the tasks as well (thread 0),
+// so a pool of 1 thread runs everything inline without any synchronization.
+class NetThreadPool {
+private:
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _wakeUp, _done;
+    const void* _task;                      // Task of the current job, called as task(task index, thread index)
+    void (*_invokeTask)(const void* task, long index, long thread);
+    long _taskCount;
+    std::atomic<long> _nextTask;
+    long _busyWorkers;
+    ulong _generation;                      // Incremented for every job, so workers never run a job twice
+    bool _shutdown;
+
+public:
+    NetThreadPool(long threadCount) : _task(nullptr), _invokeTask(nullptr), _taskCount(0), _nextTask(0), _busyWorkers(0), _generation(0), _shutdown(false) {
+        if (threadCount <= 0) { threadCount = std::max<long>(1, std::thread::hardware_concurrency()); }
+        for (long t = 1; t < threadCount; t++) {
+            _workers.push_back(std::thread(&NetThreadPool::WorkerLoop, this, t));
+        }
+    }
+
+    ~NetThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _shutdown = true;
+        }
+        _wakeUp.notify_all();
+        for (auto& w : _workers) { w.join(); }
+    }
+
+    NetThreadPool(const NetThreadPool&) = delete;
+    NetThreadPool& operator=(const NetThreadPool&) = delete;
+
+
+    inline long ThreadCount() const { return _workers.size() + 1; }
+
+
+    // Run task(i, thread) for every i in [0, taskCount) and wait for all of them
+    // (The task is only referenced, not copied, so running a job never allocates)
+    template<typename Task>
+    void Run(long taskCount, const Task& task) {
+        if (taskCount <= 0) { return; }
+        if (_workers.empty() || taskCount == 1) {
+            for (long i = 0; i < taskCount; i++) { task(i, 0); }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _task = &task;
+            _invokeTask = [](const void* t, long index, long thread) { (*static_cast<const Task*>(t))(index, thread); };
+            _taskCount = taskCount;
+            _nextTask = 0;
+            _busyWorkers = _workers.size();
+            _generation++;
+        }
+        _wakeUp.notify_all();
+        RunTasks(0);
+        // Wait until every worker has left the job (they may still hold a reference to _task)
+        std::unique_lock<std::mutex> lock(_mutex);
+        _done.wait(lock, [this] { return _busyWorkers == 0; });
+        _task = nullptr;
+    }
+
+
+private:
+    void RunTasks(long thread) {
+        for (long i = _nextTask++; i < _taskCount; i = _nextTask++) { _invokeTask(_task, i, thread); }
+    }
+
+    void WorkerLoop(long thread) {
+        ulong seenGeneration = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _wakeUp.wait(lock, [&] { return _shutdown || _generation != seenGeneration; });
+                if (_shutdown) { return; }
+                seenGeneration = _generation;
+            }
+            RunTasks(thread);
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (--_busyWorkers == 0) { _done.notify_one(); }
+            }
+        }
+    }
+
+};
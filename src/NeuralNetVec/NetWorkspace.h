@@ -0,0 +1,102 @@
+//  NetWorkspace.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <algorithm>
+
+#include "../NetBase.h"
+
+// All the buffers one FeedForward / BackPropagate step writes to. Sized once from the
+// topology and the batch size, so a training step never touches the heap (the kernels
+// in NetMath.h write into these buffers instead of returning new Vectors / Matrices).
+// dEdW is not stored: the weight gradients are applied in the sweep that computes them.
+// (T = scalar type of the net)
+template<typename T>
+struct NetWorkspace {
+    const Topology layers;
+    long batchCapacity;                         // Max. samples per step the buffers can hold
+    std::vector<std::vector<T>> neuronVectors;  // H  (batch x layerNeurons, [0] holds the net input)
+    std::vector<std::vector<T>> derivatives;    // f'(W.H + B) of each hidden layers output (batch x nextLayerNeurons)
+    std::vector<std::vector<T>> biasDeltas;     // dEdB (batch x nextLayerNeurons)
+    std::vector<T> expectedOutput;              // Expected net output (batch x outputNeurons)
+    std::vector<T> gradientRow;                 // One row of dEdW / the dEdB sum (optimizer updates, see NetOptimizer.h)
+    std::vector<long> inputIndices;             // Nonzero inputs of each sample (batch x inputNeurons, sparse input layer, see NetMath.h)
+    std::vector<long> inputCounts;              // Number of nonzero inputs of each sample (batch)
+
+    NetWorkspace(const Topology& topology, long batchSize) : layers(topology), batchCapacity(0) {
+        const long lastLayer = layers.size() - 1;
+        neuronVectors = std::vector<std::vector<T>>(layers.size());
+        derivatives = std::vector<std::vector<T>>(lastLayer - 1);
+        biasDeltas = std::vector<std::vector<T>>(lastLayer);
+        gradientRow.resize(*std::max_element(layers.begin(), layers.end()));
+        Reserve(batchSize);
+    }
+
+
+    // Grow the batch dependent buffers (only allocates if the batch is larger than ever before)
+    void Reserve(long batchSize) {
+        if (batchSize <= batchCapacity) { return; }
+        batchCapacity = batchSize;
+        for (ulong i = 0; i < layers.size(); i++) {
+            neuronVectors[i].resize(batchSize * layers[i]);
+        }
+        for (ulong i = 0; i < layers.size() - 1; i++) {
+            biasDeltas[i].resize(batchSize * layers[i + 1]);
+        }
+        for (ulong i = 0; i < layers.size() - 2; i++) {
+            derivatives[i].resize(batchSize * layers[i + 1]);
+        }
+        expectedOutput.resize(batchSize * layers.back());
+        inputIndices.resize(batchSize * layers.front());
+        inputCounts.resize(batchSize);
+    }
+
+};
+
+
+// Gradient sums of one shard of a batch (data-parallel training): Every worker accumulates
+// its samples into its own buffers, the shards are reduced before the weight update
+template<typename T>
+struct NetGradients {
+    std::vector<std::vector<T>> weightDeltas;   // Sum of dEdW over the samples of the shard
+    std::vector<std::vector<T>> biasDeltas;     // Sum of dEdB over the samples of the shard
+
+    NetGradients(const Topology& layers) {
+        const long lastLayer = layers.size() - 1;
+        weightDeltas = std::vector<std::vector<T>>(lastLayer);
+        biasDeltas = std::vector<std::vector<T>>(lastLayer);
+        for (long i = 0; i < lastLayer; i++) {
+            weightDeltas[i] = std::vector<T>(layers[i + 1] * layers[i]);
+            biasDeltas[i] = std::vector<T>(layers[i + 1]);
+        }
+    }
+};
@@ -0,0 +1,324 @@
+//  NeuralNetFixed.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <memory>
+#include <type_traits>
+
+#include "../MNIST.h"
+#include "../NetActivation.h"
+#include "../NetEvaluation.h"
+
+#if WINDOWS
+    #include <malloc.h>
+#endif
+
+// NeuralNetVec for a topology that is known at compile time (e.g. NeuralNetFixed<float, LAYER_NEURONS>):
+// All the weights and buffers live in cache line aligned std::arrays inside the net, and every
+// loop bound is a constant, so the compiler can unroll and vectorize the kernels without any
+// size or bounds checks. Same math as NeuralNetVec with a batch size of 1 (stochastic / on-line
+// training) and the same random start weights (for the same srand seed).
+// Only sigmoid activations: HIDDEN_ACTIVATION / OUTPUT_ACTIVATION are not supported (an error is reported when they differ).
+// The net holds all of its weights, so it is too large for the stack: create it with new / std::make_unique
+// (the class allocates itself cache line aligned, C++14 new does not respect alignas on its own)
+
+#define FIXED_ALIGNMENT             64                          // Cache line (and AVX-512 register) size
+
+// Sizes and offsets of the arrays of a fixed topology (every array of a layer starts on a new cache line)
+template<typename T, size_t... Layers>
+struct NetFixedLayout {
+    static constexpr size_t LayerCount = sizeof...(Layers);
+    static constexpr size_t LastLayer = LayerCount - 1;
+    static constexpr size_t Lanes = FIXED_ALIGNMENT / sizeof(T);
+    
+    static constexpr size_t Neurons(size_t layer) {
+        const size_t neurons[] = { Layers... };
+        return neurons[layer];
+    }
+    static constexpr size_t Padded(size_t n) { return (n + Lanes - 1) / Lanes * Lanes; }
+    static constexpr size_t WeightOffset(size_t layer) {
+        size_t offset = 0;
+        for (size_t i = 0; i < layer; i++) { offset += Padded(Neurons(i + 1) * Neurons(i)); }
+        return offset;
+    }
+    static constexpr size_t NeuronOffset(size_t layer) {
+        size_t offset = 0;
+        for (size_t i = 0; i < layer; i++) { offset += Padded(Neurons(i)); }
+        return offset;
+    }
+    // Biases and bias deltas of layer i belong to the neurons of layer i+1
+    static constexpr size_t BiasOffset(size_t layer) { return NeuronOffset(layer + 1) - NeuronOffset(1); }
+};
+
+
+template<typename T, size_t... Layers>
+class NeuralNetFixed {
+    static_assert(sizeof...(Layers) >= 2, "The net needs at least an input and an output layer");
+    
+    typedef NetFixedLayout<T, Layers...> Layout;
+    template<size_t I> using Layer = std::integral_constant<size_t, I>;
+    
+public:
+    static constexpr size_t LayerCount = Layout::LayerCount;
+    static constexpr size_t LastLayer = Layout::LastLayer;
+    static constexpr size_t Neurons(size_t layer) { return Layout::Neurons(layer); }
+    
+    typedef std::array<T, Layout::Neurons(0)> Input;
+    typedef std::array<T, Layout::Neurons(Layout::LastLayer)> Output;
+    
+private:
+    static constexpr size_t Lanes = Layout::Lanes;
+    
+    const double _learningRate;
+    alignas(FIXED_ALIGNMENT) std::array<T, Layout::WeightOffset(Layout::LastLayer)> _weights;      // W
+    alignas(FIXED_ALIGNMENT) std::array<T, Layout::BiasOffset(Layout::LastLayer)> _biases;         // B
+    alignas(FIXED_ALIGNMENT) std::array<T, Layout::NeuronOffset(Layout::LayerCount)> _neurons;     // H ([0] holds the net input)
+    alignas(FIXED_ALIGNMENT) std::array<T, Layout::BiasOffset(Layout::LastLayer)> _biasDeltas;     // dEdB
+    alignas(FIXED_ALIGNMENT) Output _expectedOutput;
+    
+public:
+    NeuralNetFixed(double learningRate) : _learningRate(learningRate) {
+        _weights.fill(0);
+        _biases.fill(0);
+        _neurons.fill(0);
+        _biasDeltas.fill(0);
+        if (HIDDEN_ACTIVATION != Activation::Sigmoid || OUTPUT_ACTIVATION != Activation::Sigmoid) {
+            std::cout <<"ERROR: NeuralNetFixed only supports the sigmoid activation, it ignores HIDDEN_ACTIVATION / OUTPUT_ACTIVATION" <<std::endl;
+        }
+        // Random start weights in the order of NeuralNetVec
+        for (size_t i = 0; i < LastLayer; i++) {
+            for (size_t w = 0; w < Neurons(i + 1) * Neurons(i); w++) { _weights[Layout::WeightOffset(i) + w] = random_0_1; }
+            for (size_t b = 0; b < Neurons(i + 1); b++) { _biases[Layout::BiasOffset(i) + b] = random_0_1; }
+        }
+    }
+    
+    static void* operator new(size_t size) {
+        void* memory = nullptr;
+#if WINDOWS
+        memory = _aligned_malloc(size, FIXED_ALIGNMENT);
+#else
+        if (posix_memalign(&memory, FIXED_ALIGNMENT, size) != 0) { memory = nullptr; }
+#endif
+        if (memory == nullptr) { throw std::bad_alloc(); }
+        return memory;
+    }
+    
+    static void operator delete(void* memory) {
+#if WINDOWS
+        _aligned_free(memory);
+#else
+        free(memory);
+#endif
+    }
+    
+    
+    // Stochastic (on-line) training: every digit is fed forward and backpropagated on its own
+    void Train(long iterations, const MNISTset& trainingData) {
+        if (!Accepts(trainingData)) { return; }
+        for (long i = 0; i < iterations; i++) {
+            for (const auto t : trainingData) {
+                t.normalizedPixels(NeuronValues<0>());
+                t.expectedOutput(_expectedOutput.data());
+                ForwardPass(Layer<1>());
+                BackPropagate(_expectedOutput);
+            }
+        }
+    }
+    
+    
+    // Take the net input and return the net output
+    Output FeedForward(const Input& input) {
+        std::copy(input.begin(), input.end(), NeuronValues<0>());
+        return ForwardOutput();
+    }
+    
+    Output FeedForward(const MNISTchar& digit) {
+        digit.normalizedPixels(NeuronValues<0>());
+        return ForwardOutput();
+    }
+    
+    
+    // Backpropagate the last fed forward digit
+    void BackPropagate(const Output& expectedOutput) {
+        // dEdB[last] = (H[last] - expectedOutput) * sigmoid'
+        T* H = NeuronValues<LastLayer>();
+        T* dEdB = BiasDeltas<LastLayer - 1>();
+        for (size_t r = 0; r < Neurons(LastLayer); r++) { dEdB[r] = (H[r] - expectedOutput[r]) * (H[r] * (1 - H[r])); }
+        // The deltas of all hidden layers from the old weights, then the weight update
+        HiddenDeltas(Layer<LastLayer - 1>());
+        UpdateWeights(Layer<0>());
+    }
+    
+    
+    // Score the net on a data set (see NetEvaluation.h)
+    NetEvaluation Evaluate(const MNISTset& data, long topK = EVALUATION_TOP_K, NetResultConsumer* consumer = nullptr) {
+        NetEvaluation evaluation(topK);
+        if (!Accepts(data)) { return evaluation.Finish(); }
+        double output[Neurons(LastLayer)];
+        for (const auto t : data) {
+            const Output result = FeedForward(t);
+            std::copy(result.begin(), result.end(), output);
+            evaluation.Add(output, t.label);
+            if (consumer != nullptr) { consumer->Consume(t, output); }
+        }
+        return evaluation.Finish();
+    }
+    
+    
+    // GETTER
+    inline Topology layers() const { return Topology{ Layers... }; }
+    inline const T* weights(size_t layer) const { return _weights.data() + Layout::WeightOffset(layer); }
+    inline const T* biases(size_t layer) const { return _biases.data() + Layout::BiasOffset(layer); }
+    
+private:
+    template<size_t I> inline T* Weights() { return _weights.data() + Layout::WeightOffset(I); }
+    template<size_t I> inline T* Biases() { return _biases.data() + Layout::BiasOffset(I); }
+    template<size_t I> inline T* NeuronValues() { return _neurons.data() + Layout::NeuronOffset(I); }
+    template<size_t I> inline T* BiasDeltas() { return _biasDeltas.data() + Layout::BiasOffset(I); }
+    
+    
+    bool Accepts(const MNISTset& data) const {
+        if (data.imageSize() != Neurons(0) || Neurons(LastLayer) != MNIST_CLASSES) {
+            std::cout <<"ERROR: " <<data.imageSize() <<" pixel digits do not fit a " <<Neurons(0) <<" input / "
+                      <<Neurons(LastLayer) <<" output neuron net" <<std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    
+    inline Output ForwardOutput() {
+        ForwardPass(Layer<1>());
+        Output output;
+        std::copy(NeuronValues<LastLayer>(), NeuronValues<LastLayer>() + Neurons(LastLayer), output.begin());
+        return output;
+    }
+    
+    
+    // H[I] = sigmoid(W[I-1] . H[I-1] + B[I-1]), 4 weight rows share every loaded value
+    template<size_t I>
+    void ForwardPass(Layer<I>) {
+        constexpr size_t Rows = Neurons(I), Columns = Neurons(I - 1);
+        const T* W = Weights<I - 1>();
+        const T* x = NeuronValues<I - 1>();
+        const T* B = Biases<I - 1>();
+        T* H = NeuronValues<I>();
+        constexpr size_t BlockedRows = Rows / 4 * 4;
+        for (size_t r = 0; r < BlockedRows; r += 4) {
+            T sums[4];
+            Dot4<Columns>(W + r * Columns, x, sums);
+            for (size_t k = 0; k < 4; k++) { H[r + k] = Sigmoid(sums[k] + B[r + k]); }
+        }
+        for (size_t r = BlockedRows; r < Rows; r++) { H[r] = Sigmoid(Dot<Columns>(W + r * Columns, x) + B[r]); }
+        ForwardPass(Layer<I + 1>());
+    }
+    void ForwardPass(Layer<LayerCount>) { }
+    
+    
+    // dEdB[I-1] = (W[I]^T . dEdB[I]) * sigmoid'(H[I])
+    template<size_t I>
+    void HiddenDeltas(Layer<I>) {
+        constexpr size_t Rows = Neurons(I + 1), Columns = Neurons(I);
+        const T* W = Weights<I>();
+        const T* delta = BiasDeltas<I>();
+        const T* H = NeuronValues<I>();
+        T* result = BiasDeltas<I - 1>();
+        std::fill(result, result + Columns, 0);
+        for (size_t r = 0; r < Rows; r++) { Axpy<Columns>(delta[r], W + r * Columns, result); }
+        for (size_t c = 0; c < Columns; c++) { result[c] *= (H[c] * (1 - H[c])); }
+        HiddenDeltas(Layer<I - 1>());
+    }
+    void HiddenDeltas(Layer<0>) { }
+    
+    
+    // W[I] -= learningRate * dEdB[I] x H[I],  B[I] -= learningRate * dEdB[I]
+    template<size_t I>
+    void UpdateWeights(Layer<I>) {
+        constexpr size_t Rows = Neurons(I + 1), Columns = Neurons(I);
+        const T learningRate = (T)_learningRate;
+        T* W = Weights<I>();
+        T* B = Biases<I>();
+        const T* delta = BiasDeltas<I>();
+        const T* H = NeuronValues<I>();
+        for (size_t r = 0; r < Rows; r++) {
+            Axpy<Columns>(-learningRate * delta[r], H, W + r * Columns);
+            B[r] -= learningRate * delta[r];
+        }
+        UpdateWeights(Layer<I + 1>());
+    }
+    void UpdateWeights(Layer<LastLayer>) { }
+    
+    
+    // Fixed size kernels: "Lanes" independent partial sums (one cache line), so the compiler keeps
+    // them in SIMD registers without reordering any floating point additions on its own
+    template<size_t N>
+    static inline T Dot(const T* __restrict a, const T* __restrict b) {
+        T lanes[Lanes] = {};
+        for (size_t i = 0; i + Lanes <= N; i += Lanes) {
+            for (size_t k = 0; k < Lanes; k++) { lanes[k] += a[i + k] * b[i + k]; }
+        }
+        T sum = 0;
+        for (size_t i = N / Lanes * Lanes; i < N; i++) { sum += a[i] * b[i]; }
+        for (size_t k = 0; k < Lanes; k++) { sum += lanes[k]; }
+        return sum;
+    }
+    
+    template<size_t N>
+    static inline void Dot4(const T* __restrict rows, const T* __restrict x, T* __restrict out) {
+        T lanes0[Lanes] = {}, lanes1[Lanes] = {}, lanes2[Lanes] = {}, lanes3[Lanes] = {};
+        for (size_t i = 0; i + Lanes <= N; i += Lanes) {
+            for (size_t k = 0; k < Lanes; k++) {
+                const T value = x[i + k];
+                lanes0[k] += rows[i + k] * value;
+                lanes1[k] += rows[N + i + k] * value;
+                lanes2[k] += rows[2 * N + i + k] * value;
+                lanes3[k] += rows[3 * N + i + k] * value;
+            }
+        }
+        T* lanes[4] = { lanes0, lanes1, lanes2, lanes3 };
+        for (size_t r = 0; r < 4; r++) {
+            T sum = 0;
+            for (size_t i = N / Lanes * Lanes; i < N; i++) { sum += rows[r * N + i] * x[i]; }
+            for (size_t k = 0; k < Lanes; k++) { sum += lanes[r][k]; }
+            out[r] = sum;
+        }
+    }
+    
+    template<size_t N>
+    static inline void Axpy(T a, const T* __restrict x, T* __restrict y) {
+        for (size_t i = 0; i < N; i++) { y[i] += a * x[i]; }
+    }
+    
+    static inline T Sigmoid(T x) { return 1 / (1 + exp(-x)); }
+    
+};
@@ -31,152 +31,694 @@
 
 #pragma once
 
+#include <memory>
+
+#include "../MNIST.h"
+#include "../NetModel.h"
+#include "../NetReport.h"
+#include "../NetMetrics.h"
+#include "../NetPipeline.h"
+#include "../NetCheckpoint.h"
 #include "NetMath.h"
+#include "NetOptimizer.h"
+#include "NetWorkspace.h"
+#include "NetThreadPool.h"
+#include "NetAsync.h"
 
-class NeuralNetVec {
+// T = scalar type of the weights and all the buffers (float for production, double for reference runs)
+template<typename T>
+class NeuralNetVecT {
 private:
+    typedef std::vector<T> Values;          // Vector / matrix of the net precision
+
     const Topology _layers;
     const long _layerCount, _lastLayer, _hiddenLayerCount;
-    const double _learningRate;
-    std::vector<Vector> _neuronVectors;     // H
-    std::vector<Matrix> _weights;           // W
-    std::vector<Vector> _biases;            // B
-    std::vector<Matrix> _weightDeltas;      // dEdW
-    std::vector<Vector> _biasDeltas;        // dEdB
+    double _learningRate;
+    const long _batchSize;                  // Samples per weight update (1 = stochastic / on-line training)
+    std::vector<Values> _weights;           // W
+    std::vector<Values> _biases;            // B
+    NetWorkspace<T> _workspace;                // H, dEdB, ... (preallocated, see NetWorkspace.h)
+    // Data-parallel training: Each batch is split into "_gradientShards" fixed shards. The threads of
+    // the pool compute the gradient sums of the shards, which are reduced in a fixed tree order.
+    // So the results only depend on the shard count and not on the number of threads
+    long _gradientShards;
+    std::unique_ptr<NetThreadPool> _pool;
+    std::vector<NetWorkspace<T>> _shardWorkspaces;
+    std::vector<NetGradients<T>> _shardGradients;
+    // Imported model: Inference runs on the mapped weights until the first training step copies them
+    std::shared_ptr<const NetModel> _model;
+    // Weight update rule (SGD by default) and its state, "slots" arrays of the weight / bias shape per layer
+    NetOptimizer _optimizer;
+    ulong _optimizerStep;
+    std::vector<std::vector<Values>> _weightSlots;  // [slot][layer]
+    std::vector<std::vector<Values>> _biasSlots;    // [slot][layer]
+    Activation _hiddenActivation, _outputActivation;
+    NetMetrics* _metrics;                   // Training instrumentation (not owned, see NetMetrics.h)
+    // Checkpoints of Train (see NetCheckpoint.h) and the position a resumed run continues at
+    std::unique_ptr<NetCheckpointWriter<T>> _checkpoints;
+    long _checkpointInterval;
+    ulong _shuffleSeed;
+    bool _resumed;
+    long _resumeEpoch;
+    ulong _resumeSample;
+    // Sparse input layer (SPARSE_INPUT, see NetMath.h): While Train runs on sparse digits, the input layer is trained
+    // on the transposed weights in "_inputWeights" (W[0] is only up to date again at the checkpoints and at the end)
+    bool _sparseInput;
+    Values _inputWeights;
+    bool _shuffle, _allowSparseInput;       // Train options (SHUFFLE_SAMPLES / SPARSE_INPUT by default)
     
 public:
-    NeuralNetVec(const Topology& layers, double learningRate)
-    : _layers(layers), _layerCount(layers.size()), _lastLayer(_layerCount - 1), _hiddenLayerCount(_layerCount - 2), _learningRate(learningRate) {
-        _neuronVectors = std::vector<Vector>(_layerCount);      // Each Layer has a neuron vector (Input/Hidden/Output)
-        _weights = std::vector<Matrix>(_lastLayer);             // Each Layer holds the weights for the next layers neurons (-1 for Output)
-        _biases = std::vector<Vector>(_lastLayer);              // Each Layer holds the biases for the next layers neurons (-1 for Output)
-        _weightDeltas = std::vector<Matrix>(_lastLayer);
-        _biasDeltas = std::vector<Vector>(_lastLayer);
+    // threadCount: 0 = all cores / gradientShards: fixed split of every batch, independent of the threads (1 = fused single-threaded update)
+    NeuralNetVecT(const Topology& layers, double learningRate, long batchSize = 1, long threadCount = 1, long gradientShards = GRADIENT_SHARDS)
+    : _layers(layers), _layerCount(layers.size()), _lastLayer(_layerCount - 1), _hiddenLayerCount(_layerCount - 2), _learningRate(learningRate),
+      _batchSize(batchSize > 0 ? batchSize : 1), _workspace(layers, _batchSize), _pool(new NetThreadPool(threadCount)),
+      _optimizer(NetOptimizer::SGD()), _optimizerStep(0), _hiddenActivation(HIDDEN_ACTIVATION), _outputActivation(OUTPUT_ACTIVATION), _metrics(nullptr),
+      _checkpointInterval(CHECKPOINT_INTERVAL), _shuffleSeed(0), _resumed(false), _resumeEpoch(0), _resumeSample(0),
+      _sparseInput(false), _shuffle(SHUFFLE_SAMPLES), _allowSparseInput(SPARSE_INPUT) {
+        _weights = std::vector<Values>(_lastLayer);             // Each Layer holds the weights for the next layers neurons (-1 for Output)
+        _biases = std::vector<Values>(_lastLayer);              // Each Layer holds the biases for the next layers neurons (-1 for Output)
         
         // Initialize all weight matrices and bias vectors with random values
         for (long i = 0; i < _lastLayer; i++) {
             // Weight matrix (rows = nextLayerNeurons, columns = thisLayerNeurons)
-            _weights[i] = Matrix(_layers[i + 1] * _layers[i]);
+            _weights[i] = Values(_layers[i + 1] * _layers[i]);
             for (long mc = 0; mc < _weights[i].size(); mc++) {
                 _weights[i][mc] = random_0_1;
             }
             
             // Bias vectors (length = nextLayerNeutrons)
-            _biases[i] = Vector(_layers[i + 1]);
+            _biases[i] = Values(_layers[i + 1]);
             for (long bc = 0; bc < _biases[i].size(); bc++) {
                 _biases[i][bc] = random_0_1;
             }
         }
+        
+        InitShards(gradientShards);
+    }
+    
+    
+    // Load an exported model (see NetModel.h): Inference runs straight on the memory mapped weights
+    // (nothing is copied or parsed), the first training step copies them into the net.
+    // A model of the other precision (float / double) is converted right away. Returns nullptr if the model can not be loaded
+    static std::unique_ptr<NeuralNetVecT> Import(const std::string& modelPath, long batchSize = 1, long threadCount = 1, long gradientShards = GRADIENT_SHARDS) {
+        std::shared_ptr<const NetModel> model(new NetModel(modelPath));
+        if (!model->isValid()) { return nullptr; }
+        return std::unique_ptr<NeuralNetVecT>(new NeuralNetVecT(model, batchSize, threadCount, gradientShards));
+    }
+    
+    
+    // Continue an interrupted run from a checkpoint (see SetCheckpoints): The net gets the weights, the optimizer
+    // state, the batch size and the gradient shards of the checkpoint, and its next Train call (with the "iterations"
+    // of the interrupted call) skips the samples the run had trained already. Returns nullptr if the checkpoint can not be loaded
+    static std::unique_ptr<NeuralNetVecT> Resume(const std::string& checkpointPath, long threadCount = 1) {
+        NetTrainingState state;
+        if (!ReadTrainingState(checkpointPath, state)) { return nullptr; }
+        std::unique_ptr<NeuralNetVecT> net = Import(checkpointPath, state.batchSize, threadCount, state.gradientShards);
+        if (!net) { return nullptr; }
+        net->_optimizer.momentum = state.momentum;
+        net->_optimizer.beta1 = state.beta1;
+        net->_optimizer.beta2 = state.beta2;
+        net->_optimizer.epsilon = state.epsilon;
+        net->_shuffleSeed = state.seed;
+        net->_resumed = true;
+        net->_resumeEpoch = state.epoch;
+        net->_resumeSample = state.sample;
+        return net;
+    }
+    
+    
+    // (With the optimizer state, so training can go on after an import)
+    void Export(const std::string& modelPath) const {
+        if (!_model) {
+            WriteNetModel(modelPath, _layers, _learningRate, _optimizer.type, _weights, _biases, _weightSlots, _biasSlots, _optimizerStep,
+                          _hiddenActivation, _outputActivation);
+            return;
+        }
+        std::vector<Values> weights(_lastLayer);
+        std::vector<Values> biases(_lastLayer);
+        for (long i = 0; i < _lastLayer; i++) {
+            weights[i].resize(_layers[i + 1] * _layers[i]);
+            biases[i].resize(_layers[i + 1]);
+            _model->copyWeights(i, weights[i].data());
+            _model->copyBiases(i, biases[i].data());
+        }
+        WriteNetModel(modelPath, _layers, _learningRate, _optimizer.type, weights, biases, _weightSlots, _biasSlots, _optimizerStep,
+                      _hiddenActivation, _outputActivation);
+    }
+    
+    
+    // Select the activation functions (see NetActivation.h), Softmax is only possible on the output layer
+    bool SetActivations(Activation hidden, Activation output) {
+        if (hidden == Activation::Softmax) {
+            std::cout <<"ERROR: Softmax is only supported on the output layer" <<std::endl;
+            return false;
+        }
+        _hiddenActivation = hidden;
+        _outputActivation = output;
+        return true;
+    }
+    
+    
+    // Inference copy of the current weights on its own (single thread) pool, e.g. to evaluate
+    // them on another thread while this net trains on (no optimizer state, see NetEarlyStopping.h)
+    std::unique_ptr<NeuralNetVecT> Snapshot() const {
+        return std::unique_ptr<NeuralNetVecT>(new NeuralNetVecT(*this, 1));
+    }
+    
+    
+    // Take over the weights of a net with the same topology (e.g. a Snapshot), the optimizer state stays
+    bool CopyWeights(const NeuralNetVecT& net) {
+        if (net._layers != _layers) {
+            std::cout <<"ERROR: Copying the weights of a net with a different topology" <<std::endl;
+            return false;
+        }
+        MaterializeModel();
+        for (long i = 0; i < _lastLayer; i++) {
+            std::copy(net.WeightData(i), net.WeightData(i) + _weights[i].size(), _weights[i].begin());
+            std::copy(net.BiasData(i), net.BiasData(i) + _biases[i].size(), _biases[i].begin());
+        }
+        return true;
+    }
+    
+    
+    // Learning rate of the next training steps (e.g. cut when the validation accuracy plateaus)
+    void SetLearningRate(double learningRate) { _learningRate = learningRate; }
+    
+    
+    // Write a checkpoint every "interval" samples of Train (on a background thread, see NetCheckpoint.h), "" = no checkpoints
+    void SetCheckpoints(const std::string& checkpointPath, long interval = CHECKPOINT_INTERVAL) {
+        _checkpoints.reset(checkpointPath.empty() ? nullptr : new NetCheckpointWriter<T>(checkpointPath));
+        _checkpointInterval = std::max<long>(1, interval);
+    }
+    
+    
+    // Select the weight update rule of Train / BackPropagate (see NetOptimizer.h), its state starts at zero
+    void SetOptimizer(const NetOptimizer& optimizer) {
+        _optimizer = optimizer;
+        _optimizerStep = 0;
+        _weightSlots = std::vector<std::vector<Values>>(optimizer.slots(), std::vector<Values>(_lastLayer));
+        _biasSlots = std::vector<std::vector<Values>>(optimizer.slots(), std::vector<Values>(_lastLayer));
+        for (ulong s = 0; s < optimizer.slots(); s++) {
+            for (long i = 0; i < _lastLayer; i++) {
+                _weightSlots[s][i] = Values(_layers[i + 1] * _layers[i], 0.0);
+                _biasSlots[s][i] = Values(_layers[i + 1], 0.0);
+            }
+        }
+    }
+    
+    
+    // Report the training phases, samples and loss of Train / TrainAsync / BackPropagate to "metrics"
+    // (nullptr = off, the pool threads / async workers use the counters of their thread index,
+    // threads beyond metrics->ThreadCount() are not counted)
+    void SetMetrics(NetMetrics* metrics) {
+        if (metrics && metrics->ThreadCount() < _pool->ThreadCount()) {
+            std::cout <<"ERROR: Metrics counters for only " <<metrics->ThreadCount() <<" of " <<_pool->ThreadCount() <<" threads (the others are not counted)" <<std::endl;
+        }
+        _metrics = metrics;
     }
     
+    // Train options: a new random sample order every iteration / the sparse input layer (e.g. off for comparisons
+    // with NeuralNetFixed). A resumed net starts with the defaults, set them before its next Train call
+    void SetShuffle(bool shuffle) { _shuffle = shuffle; }
+    void SetSparseInput(bool sparseInput) { _allowSparseInput = sparseInput; }
     
-    void Train(long iterations, const std::vector<Vector>& trainingInput, const std::vector<Vector>& trainingOutput) {
-        for (long i = 0; i < iterations; i++) {
-            for (long t = 0; t < trainingInput.size(); t++) {
-                FeedForward(trainingInput[t]);
-                BackPropagate(trainingOutput[t]);
+    
+    // Train in mini-batches of "_batchSize" samples: The samples of one batch are fed forward
+    // and backpropagated together and the weights are updated once per batch (averaged gradients).
+    // The batches come from a NetPipeline (assembled on a background thread, shuffled every iteration, see SetShuffle)
+    void Train(long iterations, const MNISTset& trainingData) {
+        if (!Accepts(trainingData)) { return; }
+        MaterializeModel();
+        _workspace.Reserve(_batchSize);
+        if (!_resumed) { _shuffleSeed = _shuffle ? rand() : 0; }
+        NetPipeline<T> pipeline(trainingData, _batchSize, iterations, _shuffle, _shuffleSeed, _resumed ? _resumeEpoch : 0,
+                                _resumed ? _resumeSample : 0);
+        _resumed = false;
+        BeginSparseInput(trainingData);
+        NetThreadCounters* counters = Counters(0);
+        long sinceCheckpoint = 0;
+        for (;;) {
+            // (The fetch time is the time the pipeline falls behind)
+            NetPhaseTimer fetch(counters, NetPhase::Fetch);
+            NetBatch<T>* batch = pipeline.Next();
+            fetch.Stop();
+            if (batch == nullptr) { break; }
+            if (_gradientShards > 1) {
+                TrainBatchParallel(*batch);
+            } else {
+                // Lend the batch buffers to the workspace for this step (no copy)
+                std::swap(_workspace.neuronVectors[0], batch->input);
+                std::swap(_workspace.expectedOutput, batch->expectedOutput);
+                NetPhaseTimer forward(counters, NetPhase::Forward);
+                ForwardPass(_workspace, batch->count);
+                forward.Stop();
+                MetricsAddSamples(counters, _workspace.neuronVectors.back().data(), _workspace.expectedOutput.data(), _layers.back(), batch->count);
+                BackPropagate(_workspace.expectedOutput, batch->count);
+                std::swap(_workspace.neuronVectors[0], batch->input);
+                std::swap(_workspace.expectedOutput, batch->expectedOutput);
             }
+            // (A skipped checkpoint is taken after the next batch)
+            sinceCheckpoint += batch->count;
+            if (_checkpoints && sinceCheckpoint >= _checkpointInterval
+                && Checkpoint(batch->epoch, batch->first + batch->count, trainingData.size())) { sinceCheckpoint = 0; }
         }
+        EndSparseInput();
+        if (_checkpoints) { _checkpoints->Flush(); }
+    }
+    
+    
+    // Asynchronous (Hogwild!) training: "threadCount" threads take the next "_batchSize" samples,
+    // feed them forward and backpropagate them against the shared weights and update the
+    // weights right away without synchronizing with the others (see NetAsync.h for the modes)
+    // (Always plain SGD updates: the optimizer state would be shared by all threads)
+    void TrainAsync(long iterations, const MNISTset& trainingData, long threadCount, AsyncUpdate mode) {
+        if (!Accepts(trainingData)) { return; }
+        MaterializeModel();
+        if (threadCount <= 0) { threadCount = std::max<long>(1, std::thread::hardware_concurrency()); }
+        if (NET_METRICS && _metrics && _metrics->ThreadCount() < threadCount) {
+            std::cout <<"ERROR: Metrics counters for only " <<_metrics->ThreadCount() <<" of " <<threadCount <<" threads (the others are not counted)" <<std::endl;
+        }
+        AsyncLocks locks;
+        std::atomic<long> nextSample(0);
+        const long sampleCount = trainingData.size() * iterations;
+        
+        auto worker = [&](long thread) {
+            NetWorkspace<T> ws(_layers, _batchSize);
+            NetThreadCounters* counters = Counters(thread);
+            // Every thread takes disjoint batches, until all the samples of all iterations are used
+            for (long t = nextSample.fetch_add(_batchSize); t < sampleCount; t = nextSample.fetch_add(_batchSize)) {
+                const long batch = std::min<long>(_batchSize, sampleCount - t);
+                NetPhaseTimer fetch(counters, NetPhase::Fetch);
+                for (long b = 0; b < batch; b++) { LoadSample(ws, b, trainingData[(t + b) % trainingData.size()]); }
+                fetch.Stop();
+                // Mutex: read the weights under the shared lock (Atomic / RowLocks read them unsynchronized)
+                std::shared_lock<std::shared_timed_mutex> reading;
+                if (mode == AsyncUpdate::Mutex) { reading = std::shared_lock<std::shared_timed_mutex>(locks.coarse); }
+                NetPhaseTimer forward(counters, NetPhase::Forward);
+                ForwardPass(ws, batch);
+                forward.Stop();
+                MetricsAddSamples(counters, ws.neuronVectors.back().data(), ws.expectedOutput.data(), _layers.back(), batch);
+                NetPhaseTimer backward(counters, NetPhase::Backward);
+                CalculateDeltas(ws, ws.expectedOutput, batch);
+                backward.Stop();
+                if (reading) { reading.unlock(); }
+                
+                // (The update time includes waiting for the locks)
+                NetPhaseTimer update(counters, NetPhase::Update);
+                std::unique_lock<std::shared_timed_mutex> lock;
+                if (mode == AsyncUpdate::Mutex) { lock = std::unique_lock<std::shared_timed_mutex>(locks.coarse); }
+                for (long i = 0; i < _lastLayer; i++) {
+                    UpdateLayerAsync(_weights[i], _biases[i], ws.neuronVectors[i], ws.biasDeltas[i], _layers[i + 1], _layers[i],
+                                     batch, _learningRate, i, mode, locks);
+                }
+            }
+        };
+        
+        std::vector<std::thread> threads;
+        for (long t = 1; t < threadCount; t++) { threads.push_back(std::thread(worker, t)); }
+        worker(0);
+        for (auto& t : threads) { t.join(); }
     }
     
     
     // Take the net input and return the net output
-    Vector FeedForward(const Vector& input) {
-        _neuronVectors[0] = input; // Set the input layer == the input
+    // (input / output hold "batchSize" samples back to back)
+    Values FeedForward(const Values& input, long batchSize = 1) {
+        _workspace.Reserve(batchSize);
+        std::copy(input.begin(), input.begin() + batchSize * _layers.front(), _workspace.neuronVectors[0].begin());
+        const Values& output = ForwardPass(_workspace, batchSize);
+        return Values(output.begin(), output.begin() + batchSize * _layers.back());
+    }
+    
+    Values FeedForward(const MNISTchar& digit) {
+        digit.normalizedPixels(_workspace.neuronVectors[0].data());
+        const Values& output = ForwardPass(_workspace, 1);
+        return Values(output.begin(), output.begin() + _layers.back());
+    }
+    
+    
+    // Score the net on a data set: The pool feeds one batch of EVALUATION_BATCH digits per thread forward at a time.
+    // The scores are summed per batch and merged in the order of the data set, so the results do not depend on
+    // the thread count. The optional consumer gets the outputs of every digit in order (on the calling thread)
+    NetEvaluation Evaluate(const MNISTset& data, long topK = EVALUATION_TOP_K, NetResultConsumer* consumer = nullptr) {
+        NetEvaluation evaluation(topK);
+        if (!Accepts(data)) { return evaluation.Finish(); }
+        const long threads = _pool->ThreadCount();
+        const long outputs = _layers.back();
+        std::vector<NetWorkspace<T>> workspaces(threads, NetWorkspace<T>(_layers, EVALUATION_BATCH));
+        std::vector<NetEvaluation> batchScores(threads, NetEvaluation(topK));
+        std::vector<double> output(outputs);
         
-        for (long i = 1; i < _layerCount; i++) {
-            _neuronVectors[i] = CalculateDotSigmoid(_weights[i - 1], _neuronVectors[i - 1], _biases[i - 1], _layers[i]);
+        for (ulong first = 0; first < data.size(); first += threads * EVALUATION_BATCH) {
+            const long batches = std::min<long>(threads, (data.size() - first + EVALUATION_BATCH - 1) / EVALUATION_BATCH);
+            _pool->Run(batches, [&](long task, long) {
+                const long begin = first + task * EVALUATION_BATCH;
+                const long count = std::min<long>(EVALUATION_BATCH, data.size() - begin);
+                NetWorkspace<T>& ws = workspaces[task];
+                for (long b = 0; b < count; b++) { data[begin + b].normalizedPixels(ws.neuronVectors[0].data() + b * _layers.front()); }
+                const Values& H = ForwardPass(ws, count);
+                batchScores[task].Reset();
+                for (long b = 0; b < count; b++) { batchScores[task].Add(H.data() + b * outputs, data[begin + b].label); }
+            });
+            for (long task = 0; task < batches; task++) {
+                evaluation.Merge(batchScores[task]);
+                if (consumer == nullptr) { continue; }
+                const long begin = first + task * EVALUATION_BATCH;
+                const T* H = workspaces[task].neuronVectors.back().data();
+                for (ulong b = 0; b < batchScores[task].samples; b++) {
+                    std::copy(H + b * outputs, H + (b + 1) * outputs, output.begin());
+                    consumer->Consume(data[begin + b], output.data());
+                }
+            }
         }
+        return evaluation.Finish();
+    }
+    
+    
+    // Backpropagate the last fed forward batch: The sigmoid primes come from the cached outputs
+    // in H, and the weight gradients are applied to the weights in the same sweep that computes them
+    void BackPropagate(const Values& expectedOutput, long batchSize = 1) {
+        std::vector<Values>& H = _workspace.neuronVectors;
+        std::vector<Values>& dEdB = _workspace.biasDeltas;
         
-        return _neuronVectors.back();
+        MaterializeModel();
+        NetPhaseTimer backward(Counters(0), NetPhase::Backward);
+        CalculateDeltas(_workspace, expectedOutput, batchSize);
+        backward.Stop();
+        
+        // Calculate the weight gradients and update all weights and biases (in place, one sweep)
+        NetPhaseTimer update(Counters(0), NetPhase::Update);
+        if (_optimizer.type == ModelOptimizer::SGD) {
+            for (long i = 0; i < _lastLayer; i++) {
+                // W[i] = W[i].subtract(H[i].transpose().dot(dEdB[i]).multiply(learningRate))
+                // B[i] = B[i].subtract(dEdB[i].multiply(learningRate))
+                if (i == 0 && _sparseInput) {
+                    UpdateWeightFusedSparse(_inputWeights, H[0], _workspace.inputIndices.data(), _workspace.inputCounts.data(), dEdB[0],
+                                            _layers[1], _layers[0], batchSize, _learningRate);
+                } else {
+                    UpdateWeightFused(_weights[i], H[i], dEdB[i], _layers[i + 1], _layers[i], batchSize, _learningRate);
+                }
+                UpdateBiasFused(_biases[i], dEdB[i], _layers[i + 1], batchSize, _learningRate);
+            }
+            return;
+        }
+        const double learnRate = NextStepLearnRate();
+        for (long i = 0; i < _lastLayer; i++) {
+            UpdateWeightOptimizer(_optimizer, learnRate, _weights[i], SlotData(_weightSlots, 0, i), SlotData(_weightSlots, 1, i),
+                                  H[i], dEdB[i], _layers[i + 1], _layers[i], batchSize, _workspace.gradientRow.data());
+            UpdateBiasOptimizer(_optimizer, learnRate, _biases[i], SlotData(_biasSlots, 0, i), SlotData(_biasSlots, 1, i),
+                                dEdB[i], _layers[i + 1], batchSize, _workspace.gradientRow.data());
+        }
     }
     
     
-    void BackPropagate(const Vector& expectedOutput) {
-        // Calculate Error here (MSE) ... (Not needed)
+private:
+    // Net on an imported model (no random weights, the weight buffers are only allocated for training)
+    NeuralNetVecT(std::shared_ptr<const NetModel> model, long batchSize, long threadCount, long gradientShards)
+    : _layers(model->layers()), _layerCount(_layers.size()), _lastLayer(_layerCount - 1), _hiddenLayerCount(_layerCount - 2),
+      _learningRate(model->learningRate()), _batchSize(batchSize > 0 ? batchSize : 1), _workspace(_layers, _batchSize),
+      _pool(new NetThreadPool(threadCount)), _model(model), _optimizer(NetOptimizer::SGD()), _optimizerStep(0),
+      _hiddenActivation(model->hiddenActivation()), _outputActivation(model->outputActivation()), _metrics(nullptr),
+      _checkpointInterval(CHECKPOINT_INTERVAL), _shuffleSeed(0), _resumed(false), _resumeEpoch(0), _resumeSample(0),
+      _sparseInput(false), _shuffle(SHUFFLE_SAMPLES), _allowSparseInput(SPARSE_INPUT) {
+        _weights = std::vector<Values>(_lastLayer);
+        _biases = std::vector<Values>(_lastLayer);
+        InitShards(gradientShards);
+        // Continue with the optimizer state of the model (default optimizer settings)
+        if (model->optimizerSlots() > 0 && model->optimizerSlots() == ModelOptimizerSlots(model->optimizer())) {
+            SetOptimizer(NetOptimizer::Default(model->optimizer()));
+            _optimizerStep = model->optimizerStep();
+            for (ulong s = 0; s < _optimizer.slots(); s++) {
+                for (long i = 0; i < _lastLayer; i++) {
+                    model->copySlotWeights(s, i, _weightSlots[s][i].data());
+                    model->copySlotBiases(s, i, _biasSlots[s][i].data());
+                }
+            }
+        }
+        // A model of the other precision can not be used in place
+        if (model->scalarBytes() != sizeof(T)) { MaterializeModel(); }
+    }
+    
+    
+    // Inference copy (see Snapshot)
+    NeuralNetVecT(const NeuralNetVecT& net, long threadCount)
+    : _layers(net._layers), _layerCount(net._layerCount), _lastLayer(net._lastLayer), _hiddenLayerCount(net._hiddenLayerCount),
+      _learningRate(net._learningRate), _batchSize(net._batchSize), _workspace(_layers, _batchSize), _pool(new NetThreadPool(threadCount)),
+      _optimizer(NetOptimizer::SGD()), _optimizerStep(0), _hiddenActivation(net._hiddenActivation), _outputActivation(net._outputActivation),
+      _metrics(nullptr), _checkpointInterval(CHECKPOINT_INTERVAL), _shuffleSeed(0), _resumed(false), _resumeEpoch(0), _resumeSample(0),
+      _sparseInput(false), _shuffle(SHUFFLE_SAMPLES), _allowSparseInput(SPARSE_INPUT) {
+        _weights = std::vector<Values>(_lastLayer);
+        _biases = std::vector<Values>(_lastLayer);
+        for (long i = 0; i < _lastLayer; i++) {
+            _weights[i].assign(net.WeightData(i), net.WeightData(i) + _layers[i + 1] * _layers[i]);
+            _biases[i].assign(net.BiasData(i), net.BiasData(i) + _layers[i + 1]);
+        }
+        InitShards(1);
+    }
+    
+    
+    // One workspace and one set of gradient buffers per shard (a shard never holds more than its share of a batch)
+    void InitShards(long gradientShards) {
+        _gradientShards = std::min<long>((gradientShards > 0) ? gradientShards : GRADIENT_SHARDS, _batchSize);
+        if (_gradientShards > 1) {
+            const long shardCapacity = (_batchSize + _gradientShards - 1) / _gradientShards;
+            _shardWorkspaces = std::vector<NetWorkspace<T>>(_gradientShards, NetWorkspace<T>(_layers, shardCapacity));
+            _shardGradients = std::vector<NetGradients<T>>(_gradientShards, NetGradients<T>(_layers));
+        }
+    }
+    
+    
+    // Copy the weights of an imported model into the net before they are changed by training
+    void MaterializeModel() {
+        if (!_model) { return; }
+        for (long i = 0; i < _lastLayer; i++) {
+            _weights[i].resize(_layers[i + 1] * _layers[i]);
+            _biases[i].resize(_layers[i + 1]);
+            _model->copyWeights(i, _weights[i].data());
+            _model->copyBiases(i, _biases[i].data());
+        }
+        _model.reset();
+    }
+    
+    
+    // Train the input layer sparse (see _inputWeights): plain SGD on a single shard only (an optimizer
+    // updates every weight, the shards would need the row-major gradients) and only for sparse digits
+    void BeginSparseInput(const MNISTset& trainingData) {
+        _sparseInput = _allowSparseInput && _optimizer.type == ModelOptimizer::SGD && _gradientShards == 1
+                       && trainingData.density() < SPARSE_INPUT_DENSITY;
+        if (!_sparseInput) { return; }
+        _inputWeights.resize(_weights[0].size());
+        TransposeMatrix(_inputWeights.data(), _weights[0].data(), _layers[1], _layers[0]);
+    }
+    
+    void EndSparseInput() {
+        if (!_sparseInput) { return; }
+        TransposeMatrix(_weights[0].data(), _inputWeights.data(), _layers[0], _layers[1]);
+        _sparseInput = false;
+    }
+    
+    
+    // Copy the training state into the next checkpoint buffer (false if the writer is still busy with it)
+    // "epoch" / "next" = position of the next sample
+    bool Checkpoint(long epoch, ulong next, ulong epochSize) {
+        NetCheckpointData<T>* checkpoint = _checkpoints->Acquire();
+        if (checkpoint == nullptr) { return false; }
+        if (_sparseInput) { TransposeMatrix(_weights[0].data(), _inputWeights.data(), _layers[0], _layers[1]); }
+        if (next >= epochSize) {
+            epoch++;
+            next = 0;
+        }
+        checkpoint->layers = _layers;
+        checkpoint->learningRate = _learningRate;
+        checkpoint->optimizer = _optimizer.type;
+        checkpoint->optimizerStep = _optimizerStep;
+        checkpoint->hiddenActivation = _hiddenActivation;
+        checkpoint->outputActivation = _outputActivation;
+        // (Assigning to the buffers of the last checkpoint does not allocate)
+        checkpoint->weights = _weights;
+        checkpoint->biases = _biases;
+        checkpoint->slotWeights = _weightSlots;
+        checkpoint->slotBiases = _biasSlots;
+        NetTrainingState& state = checkpoint->state;
+        state.seed = _shuffleSeed;
+        state.epoch = epoch;
+        state.sample = next;
+        state.batchSize = _batchSize;
+        state.gradientShards = _gradientShards;
+        state.momentum = _optimizer.momentum;
+        state.beta1 = _optimizer.beta1;
+        state.beta2 = _optimizer.beta2;
+        state.epsilon = _optimizer.epsilon;
+        _checkpoints->Submit();
+        return true;
+    }
+    
+    
+    // Learning rate of the next optimizer update (counts the updates)
+    inline double NextStepLearnRate() { return _optimizer.StepLearnRate(_learningRate, ++_optimizerStep); }
+    
+    // Optimizer state slot s of layer i (nullptr if the optimizer has less slots)
+    inline T* SlotData(std::vector<std::vector<Values>>& slots, ulong s, long i) { return (s < slots.size()) ? slots[s][i].data() : nullptr; }
+    
+    
+    // The weights of layer i: the mapped model or the own buffers
+    inline const T* WeightData(long i) const { return _model ? _model->template weights<T>(i) : _weights[i].data(); }
+    inline const T* BiasData(long i) const { return _model ? _model->template biases<T>(i) : _biases[i].data(); }
+    
+    
+    // The digits have to match the input and output layer
+    bool Accepts(const MNISTset& data) const {
+        if (data.imageSize() != _layers.front() || _layers.back() != MNIST_CLASSES) {
+            std::cout <<"ERROR: " <<data.imageSize() <<" pixel digits do not fit a " <<_layers.front() <<" input / "
+                      <<_layers.back() <<" output neuron net" <<std::endl;
+            return false;
+        }
+        return true;
+    }
+    
+    
+    // Counters of a training thread, always nullptr without NET_METRICS (so the timers compile away)
+    inline NetThreadCounters* Counters(long thread) const { return (NET_METRICS && _metrics) ? _metrics->Thread(thread) : nullptr; }
+    
+    
+    // Batch assembly: Normalize the pixels and expand the label of a digit straight into
+    // the input layer / expected output of sample b in the workspace
+    inline void LoadSample(NetWorkspace<T>& ws, long b, const MNISTchar& digit) const {
+        digit.normalizedPixels(ws.neuronVectors[0].data() + b * _layers.front());
+        digit.expectedOutput(ws.expectedOutput.data() + b * _layers.back());
+    }
+    
+    
+    // Feed the input layer of the workspace forward (no copy of the input, no allocations)
+    const Values& ForwardPass(NetWorkspace<T>& ws, long batchSize) const {
+        std::vector<Values>& H = ws.neuronVectors;
+        long i = 1;
+        if (_sparseInput) {
+            // (The nonzero inputs are gathered once per batch, BackPropagate updates the same ones)
+            GatherNonZero(H[0].data(), ws.inputIndices.data(), ws.inputCounts.data(), _layers[0], batchSize);
+            CalculateDotActivationSparse(H[1], _inputWeights.data(), H[0], ws.inputIndices.data(), ws.inputCounts.data(), BiasData(0), _layers[1],
+                                         _layers[0], batchSize, (_lastLayer == 1) ? _outputActivation : _hiddenActivation);
+            i++;
+        }
+        for (; i < _layerCount; i++) {
+            CalculateDotActivation(H[i], WeightData(i - 1), H[i - 1], BiasData(i - 1), _layers[i], _layers[i - 1], batchSize,
+                                   (i == _lastLayer) ? _outputActivation : _hiddenActivation);
+        }
+        return H.back();
+    }
+    
+    
+    // Calculate the bias gradients dEdB of all layers for the batch in the workspace
+    void CalculateDeltas(NetWorkspace<T>& ws, const Values& expectedOutput, long batchSize) const {
+        std::vector<Values>& H = ws.neuronVectors;
+        std::vector<Values>& dEdB = ws.biasDeltas;
         
-        // Calculate the bias gradients
+        // Calculate Error here (MSE) ... (Not needed)
         
-        // tmp = H[hiddenLayersCount].dot(W[hiddenLayersCount]).add(B[hiddenLayersCount]).applyFunction(sigmoidePrime)
-        // dEdB[hiddenLayersCount] = H[hiddenLayersCount + 1].subtract(_neuronVectors.back()).multiply(tmp)
-        auto tmp = CalculateDotSigmoidPrime(_weights[_hiddenLayerCount], _neuronVectors[_hiddenLayerCount], _biases[_hiddenLayerCount], _layers[_lastLayer]);
-        _biasDeltas[_hiddenLayerCount] = CalculateLastBiasDelta(_neuronVectors.back(), expectedOutput, tmp);
+        // dEdB[hiddenLayersCount] = H[hiddenLayersCount + 1].subtract(expectedOutput).multiply(activationPrime)
+        // (The derivative comes from the cached outputs H, == H.dot(W).add(B) after the activation)
+        CalculateLastBiasDelta(dEdB[_hiddenLayerCount], H.back(), expectedOutput, _layers[_lastLayer], batchSize, _outputActivation);
         
         for (long i = _hiddenLayerCount - 1; i >= 0; i--)
         {
-            //dEdB[i] = dEdB[i + 1].dot(W[i + 1].transpose()).multiply(    H[i].dot(W[i]).add(B[i]).applyFunction(sigmoidePrime)   );
-            auto sigPresult = CalculateDotSigmoidPrime(_weights[i], _neuronVectors[i], _biases[i], _layers[i + 1]);
-            _biasDeltas[i] = CalculateBiasDelta(_biasDeltas[i + 1], _weights[i + 1], _layers[i + 2], _layers[i + 1], sigPresult);
+            //dEdB[i] = dEdB[i + 1].dot(W[i + 1].transpose()).multiply(    H[i + 1].applyFunction(activationPrime)   );
+            Values& derivative = ws.derivatives[i];
+            CalculateActivationPrime(derivative, H[i + 1], batchSize * _layers[i + 1], _hiddenActivation);
+            CalculateBiasDelta(dEdB[i], dEdB[i + 1], _weights[i + 1], _layers[i + 2], _layers[i + 1], derivative, batchSize);
         }
+    }
+    
+    
+    // Data-parallel training step: forward / backward of every shard on the pool, tree reduction
+    // of the shard gradients and one weight update with the gradients averaged over the batch
+    void TrainBatchParallel(const NetBatch<T>& samples) {
+        const long shards = _gradientShards;
+        const long batch = samples.count;
+        const long inputs = _layers.front(), outputs = _layers.back();
         
-        // Calculate the weight gradients and update all weights and biases
-        for (long i = 0; i < _lastLayer; i++) {
-            // dEdW[i] = H[i].transpose().dot(dEdB[i])
-            _weightDeltas[i] = CalculateWeightDelta(_neuronVectors[i], _biasDeltas[i]);
-            
-            // W[i] = W[i].subtract(dEdW[i].multiply(learningRate))
-            // B[i] = B[i].subtract(dEdB[i].multiply(learningRate))
-            _weights[i] = UpdateWeight(_weights[i], _weightDeltas[i], _learningRate);
-            _biases[i] = UpdateBias(_biases[i], _biasDeltas[i], _learningRate);
-        }
-    }
-    
-    
-    // Feed the test data to the net and write all results to a file
-    void test(MNIST& mnist, const std::string& resultsPath) {
-        float errSum = 0.0f;
-        int recognizeCount = 0;
-        std::vector<std::string> outputStrings = std::vector<std::string>();
-        // Add some general output with the overall error values
-        outputStrings.push_back("Overall Network Error:\t\t");
-        outputStrings.push_back("Correctly recognised digits:\t");
-        outputStrings.push_back("\n\nTest Data Digits:\n");
-        // Add some output for ever Digit in the testData
-        for(const auto& t : mnist.testData) {
-            outputStrings.push_back("----------------------------------");
-            // feed forward the testData
-            const auto result = FeedForward(t.pixelData);
-            // generate the current test digit as an ASCII picture
-            auto asciiDigit = mnist.MNISTcharToASCII(t);
-            outputStrings.insert(outputStrings.end(), asciiDigit.begin(), asciiDigit.end());
-            // generate the exprected / actual results table
-            outputStrings.push_back("\n");
-            for(ulong i = 0; i < t.output.size(); i++) {
-                outputStrings.push_back(std::to_string((int)t.output[i]) + "\t\t\t" + std::to_string((float)result[i]));
+        _pool->Run(shards, [&](long s, long thread) {
+            // Fixed split of the batch, the last batch of an iteration may leave shards empty
+            const long begin = (batch * s) / shards;
+            const long count = (batch * (s + 1)) / shards - begin;
+            NetWorkspace<T>& ws = _shardWorkspaces[s];
+            NetGradients<T>& grad = _shardGradients[s];
+            NetThreadCounters* counters = Counters(thread);
+            NetPhaseTimer fetch(counters, NetPhase::Fetch);
+            std::copy(samples.input.begin() + begin * inputs, samples.input.begin() + (begin + count) * inputs, ws.neuronVectors[0].begin());
+            std::copy(samples.expectedOutput.begin() + begin * outputs, samples.expectedOutput.begin() + (begin + count) * outputs,
+                      ws.expectedOutput.begin());
+            fetch.Stop();
+            if (count > 0) {
+                NetPhaseTimer forward(counters, NetPhase::Forward);
+                ForwardPass(ws, count);
+                forward.Stop();
+                MetricsAddSamples(counters, ws.neuronVectors.back().data(), ws.expectedOutput.data(), _layers.back(), count);
             }
-            // generate the networks guess
-            outputStrings.push_back("\n");
-            ulong num = -1, count = 0;
-            std::string tmp = "";
-            // get the Number with the highest possibility ( >= 0.8 )
-            // and check if the other are as low as expected ( <= 0.2 )
-            for(ulong i = 0; i < result.size(); i++) {
-                if(result[i] >= 0.8f) { num = i; }
-                if(result[i] <= 0.2f) { count++; }
+            NetPhaseTimer backward(counters, NetPhase::Backward);
+            if (count > 0) { CalculateDeltas(ws, ws.expectedOutput, count); }
+            for (long i = 0; i < _lastLayer; i++) {
+                CalculateWeightDeltaSum(grad.weightDeltas[i], ws.neuronVectors[i], ws.biasDeltas[i], _layers[i + 1], _layers[i], count);
+                CalculateBatchSum(grad.biasDeltas[i], ws.biasDeltas[i], _layers[i + 1], count);
             }
-            tmp += (count >= 9) ? " definitely a: " : " very likely a: ";
-            tmp += "\t" + std::to_string(num);
-            outputStrings.push_back("This is" + tmp);
-            // Check if the estimated digit is correct
-            if(num == t.label) {
-                recognizeCount++;
-                outputStrings.push_back("Network guessed:\tCORRECT");
-            } else {
-                outputStrings.push_back("Network guessed:\tWRONG");
-            }
-            outputStrings.push_back("----------------------------------");
+        });
+        
+        // Tree reduction: In every round shard s adds up shard s + stride, until shard 0 holds the sum
+        // (The order of the additions is fixed, no matter which thread runs them)
+        for (long stride = 1; stride < shards; stride *= 2) {
+            const long pairs = (shards + 2 * stride - 1) / (2 * stride);
+            _pool->Run(pairs * _lastLayer, [&](long task, long thread) {
+                NetPhaseTimer backward(Counters(thread), NetPhase::Backward);
+                const long s = (task / _lastLayer) * 2 * stride;
+                const long i = task % _lastLayer;
+                if (s + stride >= shards) { return; }
+                NetGradients<T>& to = _shardGradients[s];
+                const NetGradients<T>& from = _shardGradients[s + stride];
+                Simd<T>().Axpy(1.0, from.weightDeltas[i].data(), to.weightDeltas[i].data(), to.weightDeltas[i].size());
+                Simd<T>().Axpy(1.0, from.biasDeltas[i].data(), to.biasDeltas[i].data(), to.biasDeltas[i].size());
+            });
+        }
+        
+        // W[i] = W[i].subtract(dEdW[i].multiply(learningRate / batch))
+        // B[i] = B[i].subtract(dEdB[i].multiply(learningRate / batch))
+        const NetGradients<T>& sum = _shardGradients[0];
+        if (_optimizer.type == ModelOptimizer::SGD) {
+            _pool->Run(_lastLayer, [&](long i, long thread) {
+                NetPhaseTimer update(Counters(thread), NetPhase::Update);
+                UpdateWeight(_weights[i], _weights[i], sum.weightDeltas[i], _learningRate / batch);
+                UpdateBias(_biases[i], _biases[i], sum.biasDeltas[i], _learningRate / batch);
+            });
+            return;
         }
-        // Calculate the overall Error
-        errSum = (errSum / mnist.testData.size());
-        outputStrings[0] += std::to_string(errSum);
-        // Calculate percentage of correctly recognized digits
-        float percent = ((float)recognizeCount / mnist.testData.size()) * 100.0f;
-        outputStrings[1] += (std::to_string((int)percent) + "%  (" + std::to_string(recognizeCount)
-                             + " / " + std::to_string(mnist.testData.size()) + ")");
-        // WRITE ALL THE TEST OUTPUTS TO A FILE
-        std::fstream file (resultsPath, std::ifstream::out | std::ifstream::binary);
-        if (file.is_open()) { for(const auto& line : outputStrings) { file << line + "\n"; } }
-        file.close();
+        // Optimizer step on the averaged gradients (one fused pass per weight matrix / bias vector)
+        const double learnRate = NextStepLearnRate();
+        _pool->Run(_lastLayer, [&](long i, long thread) {
+            NetPhaseTimer update(Counters(thread), NetPhase::Update);
+            OptimizerStep<T>(_optimizer, learnRate, sum.weightDeltas[i].data(), 1.0 / batch, _weights[i].data(),
+                             SlotData(_weightSlots, 0, i), SlotData(_weightSlots, 1, i), _weights[i].size());
+            OptimizerStep<T>(_optimizer, learnRate, sum.biasDeltas[i].data(), 1.0 / batch, _biases[i].data(),
+                             SlotData(_biasSlots, 0, i), SlotData(_biasSlots, 1, i), _biases[i].size());
+        });
+    }
+    
+    
+public:
+    // GETTER
+    inline const Topology& layers() const { return _layers; }
+    inline double learningRate() const { return _learningRate; }
+    inline const T* weights(long layer) const { return WeightData(layer); }
+    inline const T* biases(long layer) const { return BiasData(layer); }
+    inline const NetOptimizer& optimizer() const { return _optimizer; }
+    inline ulong optimizerStep() const { return _optimizerStep; }
+    inline Activation hiddenActivation() const { return _hiddenActivation; }
+    inline Activation outputActivation() const { return _outputActivation; }
+    
+    
+    // Feed the test data to the net and write all results to a file (streamed while the digits are evaluated)
+    void test(MNIST& mnist, const std::string& resultsPath, ReportFormat format = ReportFormat::Text) {
+        std::unique_ptr<NetReport> report = CreateNetReport(format, resultsPath);
+        if (report) { report->Finish(Evaluate(mnist.testData, EVALUATION_TOP_K, report.get())); }
     }
     
 };
+
+typedef NeuralNetVecT<NET_SCALAR> NeuralNetVec;
@@ -57,10 +57,26 @@
 
 //  784N Input Layer / 1x 120N Hidden Layer / 10N Output Layer
 //  (Actual Net: Every Layer has one additional Bias Neuron)
-#define LAYER_NEURON_TOPOLOGY       {784, 120, 10}
+#define LAYER_NEURONS               784, 120, 10                // (Template arguments of NeuralNetFixed)
+#define LAYER_NEURON_TOPOLOGY       {LAYER_NEURONS}
 #define TRAINING_ITER               1                           // Traingin iterations with the input data
+#define SHUFFLE_SAMPLES             true                        // New random order of the training digits every iteration (see NetPipeline.h)
+#define EARLY_STOPPING              false                       // VEC net: up to TRAINING_ITER iterations, stop when the validation accuracy plateaus (see NetEarlyStopping.h)
 #define ETA                         0.7                         // Net learning rate (0.0 = slow / 1.0 = fast) (influences the deltas)
-#define ALPHA                       0.8                         // Momentum (Multiplier of the delta weights) optimal range: 0.0 - 1.0
+#define ALPHA                       0.5                         // Momentum (Multiplier of the delta weights) optimal range: 0.0 - 1.0
+#define ADAM_BETA1                  0.9                         // Adam: decay of the gradient mean (first moment)
+#define ADAM_BETA2                  0.999                       // Adam: decay of the squared gradient mean (second moment)
+#define ADAM_EPSILON                1e-8                        // Adam: keeps the step finite for tiny second moments
+#define HIDDEN_ACTIVATION           Activation::Sigmoid         // Activation function of the hidden layers (see NetActivation.h)
+#define OUTPUT_ACTIVATION           Activation::Sigmoid         // Activation function of the output layer (Softmax: output layer only)
+#define LEAKY_RELU_SLOPE            0.01                        // Slope of the leaky ReLU for negative inputs
+#define ACTIVATION_FAST_EXP         false                       // Polynomial SIMD exp for sigmoid / tanh / softmax (false = libm exp, reference results)
+#define BATCH_SIZE                  1                           // Samples per weight update of the VEC net (1 = stochastic / on-line training)
+#define THREAD_COUNT                1                           // Training threads of the VEC net (0 = all cores, splits every batch)
+#define GRADIENT_SHARDS             8                           // Fixed split of every VEC net batch (same results for any THREAD_COUNT, 1 = fused update)
+#define NET_SCALAR                  float                       // Precision of the VEC net (float = fast, double = reference / validation runs)
+#define SPARSE_INPUT                true                        // VEC net: SGD training runs the input layer over the nonzero pixels only (see NetMath.h)
+#define NET_METRICS                 false                       // Training instrumentation (see NetMetrics.h), false = compiled away
 #define SMOOTHING_FACTOR            100                         // Number of training samples to average over
 #define DEBUG_OUTPUT                true                        // Display some Debug output
 
@@ -68,8 +84,8 @@
 #define swap16(n)                   (((n&0xFF00)>>8)|((n&0x00FF)<<8))
 #define swap32(n)                   ((swap16((n&0xFFFF0000)>>16))|((swap16(n&0x0000FFFF))<<16))
 
-// Generate Random Number between 0.0f and 1.0f
-#define random_0_1                  ((rand() % 10000 + 1)/10000-0.5)
+// Generate Random Number between -0.5 and 0.5
+#define random_0_1                  ((rand() % 10000 + 1) / 10000.0 - 0.5)
 
 // Custom type definitions
 typedef unsigned long               ulong;
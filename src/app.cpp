@@ -29,11 +29,13 @@
  *                                                                                   *
  *************************************************************************************/
 
-// CLANG / GCC compiler flags:		-std=c++14 -Os
+// CLANG / GCC compiler flags:		-std=c++14 -Os -pthread
 // Visual C++ compiler flags:		/Ox
 
 #include "NeuralNetOOP/NeuralNetOOP.h"
 #include "NeuralNetVec/NeuralNetVec.h"
+#include "NeuralNetVec/NetQuant.h"
+#include "NeuralNetVec/NetEarlyStopping.h"
 
 using namespace std;
 using namespace chrono;
@@ -42,21 +44,17 @@ int main() {
     // Net Interface OOP/VEC
     
     auto netOOP = NeuralNetOOP(LAYER_NEURON_TOPOLOGY);
-    auto netVec = NeuralNetVec(LAYER_NEURON_TOPOLOGY, ETA);
+    auto netVec = NeuralNetVec(LAYER_NEURON_TOPOLOGY, ETA, BATCH_SIZE, THREAD_COUNT);
 	
     // Get the MNIST data
-    MNIST mnist = MNIST(PATH_IN);
-    std::vector<Vector> mnistInput (mnist.trainingData.size());
-    std::vector<Vector> mnistOutput (mnist.trainingData.size());
-    std::vector<Vector> mnistInput_test (mnist.testData.size());
-    std::vector<Vector> mnistOutput_test (mnist.testData.size());
-    for(ulong i = 0; i < mnist.trainingData.size(); i++) {
-        mnistInput[i] = mnist.trainingData[i].pixelData;
-        mnistOutput[i] = mnist.trainingData[i].output;
-    }
-    for(ulong i = 0; i < mnist.testData.size(); i++) {
-        mnistInput_test[i] = mnist.testData[i].pixelData;
-        mnistOutput_test[i] = mnist.testData[i].output;
+    MNIST mnist(PATH_IN);
+    
+    // Training metrics of both nets, one JSON line per METRICS_INTERVAL (only with NET_METRICS)
+    NetMetrics metrics(THREAD_COUNT);
+    if (NET_METRICS && metrics.WriteTo(std::string(PATH_OUT) + "metrics.jsonl")) {
+        netOOP.setMetrics(&metrics);
+        netVec.SetMetrics(&metrics);
+        metrics.Start();
     }
     
     const auto t1 = steady_clock::now();
@@ -64,14 +62,27 @@ int main() {
     const auto t2 = steady_clock::now();
     
     const auto t3 = steady_clock::now();
-    netVec.Train(TRAINING_ITER, mnistInput, mnistOutput);
+    if (EARLY_STOPPING) {
+        const NetEarlyStoppingReport stop = NetEarlyStopping<NET_SCALAR>().Train(netVec, mnist.trainingData, TRAINING_ITER);
+        cout << "NeuralNet VEC early stopping:\t" <<stop.iterations <<" iterations, best " <<stop.bestAccuracy <<"% after " <<stop.bestIteration <<endl;
+    } else {
+        netVec.Train(TRAINING_ITER, mnist.trainingData);
+    }
     const auto t4 = steady_clock::now();
+    metrics.Stop();
     
     netOOP.test(mnist, std::string(PATH_OUT) + "OOP.txt");
     netVec.test(mnist, std::string(PATH_OUT) + "VEC.txt");
     
     cout << "NeuralNet OOP training time:\t" <<duration_cast<seconds>(t2 - t1).count() <<" sec." <<endl;
     cout << "NeuralNet VEC training time:\t" <<duration_cast<seconds>(t4 - t3).count() <<" sec." <<endl;
+    cout << "NeuralNet VEC SIMD kernels:\t" <<Simd().name <<endl;
+    
+    // Int8 inference copy of the VEC net (calibrated on the training digits)
+    NeuralNetQuant netQuant(netVec, mnist.trainingData);
+    const QuantReport quant = CompareQuantized(netVec, netQuant, mnist.testData);
+    cout << "NeuralNet INT8 accuracy:\t" <<quant.quantAccuracy <<"% (VEC " <<quant.floatAccuracy <<"%, same digit " <<quant.agreement <<"%)" <<endl;
+    cout << "NeuralNet INT8 weights:\t\t" <<quant.quantBytes / 1024 <<" KB (VEC " <<quant.floatBytes / 1024 <<" KB), " <<QuantSimd().name <<endl;
 
 	// keep the Windows Console on screen
 	if (WINDOWS) { system("pause"); }
@@ -0,0 +1,193 @@
+//  NetBench.h
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+// Measurement harness of the benchmarks: Every benchmark runs BENCH_WARMUPS untimed calls and then
+// "repetitions" timed samples. Fast calls (kernels) are repeated inside a sample until it takes at least
+// BENCH_MIN_SAMPLE_TIME, so the clock resolution does not matter. The results keep all the samples
+// (seconds per call), the reports show the median and the percentiles and the throughput of the median.
+// (At least one timed sample per benchmark, smaller repetition counts are raised to 1)
+
+#define BENCH_WARMUPS               3                           // Untimed calls before the samples
+#define BENCH_REPETITIONS           15                          // Timed samples of a benchmark
+#define BENCH_MIN_SAMPLE_TIME       0.002                       // Seconds per sample (fast calls are repeated)
+#define BENCH_JSON_VERSION          1                           // Layout of the JSON report
+
+struct BenchResult {
+    std::string group;                      // "kernel", "oop", "vec", "data"
+    std::string name;
+    long rows, columns, batch;              // Kernel dimensions (0 = not a kernel)
+    long callsPerSample;
+    double flops, bytes;                    // Work of one call (0 = not counted)
+    std::vector<double> seconds;            // Seconds per call of every sample (sorted)
+    
+    // Linear interpolation between the sorted samples (p = 0.0 .. 1.0)
+    double Percentile(double p) const {
+        if (seconds.empty()) { return 0.0; }
+        const double position = p * (seconds.size() - 1);
+        const long below = (long)position;
+        const long above = std::min<long>(below + 1, seconds.size() - 1);
+        return seconds[below] + (seconds[above] - seconds[below]) * (position - below);
+    }
+    inline double Median() const { return Percentile(0.5); }
+    inline double GFlops() const { return (flops > 0 && Median() > 0) ? flops / Median() * 1e-9 : 0.0; }
+    inline double GBytes() const { return (bytes > 0 && Median() > 0) ? bytes / Median() * 1e-9 : 0.0; }
+};
+
+
+class NetBench {
+private:
+    std::vector<BenchResult> _results;
+    std::ostream* _out;                     // Table of the results, printed while they come in (nullptr = quiet)
+    
+public:
+    NetBench(std::ostream* out = nullptr) : _out(out) {
+        if (_out) { PrintHeader(*_out); }
+    }
+    
+    
+    // Time "run" (fast calls, repeated within a sample): flops / bytes = work of one call
+    template<typename Run>
+    const BenchResult& Measure(const std::string& group, const std::string& name, long rows, long columns, long batch,
+                               double flops, double bytes, Run run, long repetitions = BENCH_REPETITIONS) {
+        using namespace std::chrono;
+        repetitions = std::max<long>(1, repetitions);
+        for (long w = 0; w < BENCH_WARMUPS; w++) { run(); }
+        // Calls per sample: double until one sample takes BENCH_MIN_SAMPLE_TIME
+        long calls = 1;
+        for (;;) {
+            const auto t1 = steady_clock::now();
+            for (long c = 0; c < calls; c++) { run(); }
+            if (duration<double>(steady_clock::now() - t1).count() >= BENCH_MIN_SAMPLE_TIME) { break; }
+            calls *= 2;
+        }
+        BenchResult result = { group, name, rows, columns, batch, calls, flops, bytes, {} };
+        for (long r = 0; r < repetitions; r++) {
+            const auto t1 = steady_clock::now();
+            for (long c = 0; c < calls; c++) { run(); }
+            result.seconds.push_back(duration<double>(steady_clock::now() - t1).count() / calls);
+        }
+        return Add(result);
+    }
+    
+    // Time every call of "run" on its own, after an untimed "setup" (slow calls: training steps, epochs, ...)
+    template<typename Setup, typename Run>
+    const BenchResult& MeasureEach(const std::string& group, const std::string& name, Setup setup, Run run,
+                                   long repetitions = BENCH_REPETITIONS, long warmups = BENCH_WARMUPS) {
+        using namespace std::chrono;
+        repetitions = std::max<long>(1, repetitions);
+        for (long w = 0; w < warmups; w++) { setup(); run(); }
+        BenchResult result = { group, name, 0, 0, 0, 1, 0.0, 0.0, {} };
+        for (long r = 0; r < repetitions; r++) {
+            setup();
+            const auto t1 = steady_clock::now();
+            run();
+            result.seconds.push_back(duration<double>(steady_clock::now() - t1).count());
+        }
+        return Add(result);
+    }
+    
+    
+    // Human readable table of one result (times in microseconds)
+    static void Print(std::ostream& out, const BenchResult& r) {
+        std::ostringstream label;
+        label << r.group << " " << r.name;
+        if (r.rows > 0) { label << " " << r.rows << "x" << r.columns << " b" << r.batch; }
+        out << std::left << std::setw(48) << label.str() << std::right << std::fixed << std::setprecision(2)
+            << std::setw(14) << r.Median() * 1e6 << std::setw(14) << r.Percentile(0.1) * 1e6 << std::setw(14) << r.Percentile(0.9) * 1e6;
+        if (r.flops > 0) { out << std::setw(10) << r.GFlops() << " GFLOP/s"; }
+        if (r.bytes > 0) { out << std::setw(10) << r.GBytes() << " GB/s"; }
+        out << std::endl;
+    }
+    
+    static void PrintHeader(std::ostream& out) {
+        out << std::left << std::setw(48) << "Benchmark" << std::right << std::setw(14) << "Median (us)"
+            << std::setw(14) << "P10 (us)" << std::setw(14) << "P90 (us)" << "    Throughput" << std::endl;
+    }
+    
+    
+    // Machine readable report: "info" key / value pairs (strings) and every result with its samples
+    bool WriteJson(const std::string& path, const std::vector<std::pair<std::string, std::string>>& info) const {
+        std::ofstream file(path, std::ofstream::out | std::ofstream::trunc);
+        if (!file.is_open()) {
+            std::cout <<"ERROR: writing the benchmark report " <<path <<std::endl;
+            return false;
+        }
+        file << std::setprecision(9);
+        file << "{\n  \"version\": " << BENCH_JSON_VERSION << ",\n  \"info\": {";
+        for (size_t i = 0; i < info.size(); i++) {
+            file << (i ? ", " : "") << Quote(info[i].first) << ": " << Quote(info[i].second);
+        }
+        file << "},\n  \"results\": [";
+        for (size_t i = 0; i < _results.size(); i++) {
+            const BenchResult& r = _results[i];
+            file << (i ? "," : "") << "\n    {\"group\": " << Quote(r.group) << ", \"name\": " << Quote(r.name)
+                 << ", \"rows\": " << r.rows << ", \"columns\": " << r.columns << ", \"batch\": " << r.batch
+                 << ", \"callsPerSample\": " << r.callsPerSample
+                 << ", \"median\": " << r.Median() << ", \"p10\": " << r.Percentile(0.1) << ", \"p90\": " << r.Percentile(0.9)
+                 << ", \"p99\": " << r.Percentile(0.99) << ", \"min\": " << r.Percentile(0.0) << ", \"max\": " << r.Percentile(1.0)
+                 << ", \"gflops\": " << r.GFlops() << ", \"gbytes\": " << r.GBytes() << ", \"seconds\": [";
+            for (size_t s = 0; s < r.seconds.size(); s++) { file << (s ? ", " : "") << r.seconds[s]; }
+            file << "]}";
+        }
+        file << "\n  ]\n}\n";
+        return file.good();
+    }
+    
+    inline const std::vector<BenchResult>& results() const { return _results; }
+    
+private:
+    const BenchResult& Add(BenchResult& result) {
+        std::sort(result.seconds.begin(), result.seconds.end());
+        _results.push_back(result);
+        if (_out) { Print(*_out, result); }
+        return _results.back();
+    }
+    
+    static std::string Quote(const std::string& text) {
+        std::string quoted = "\"";
+        for (char c : text) {
+            if (c == '"' || c == '\\') { quoted += '\\'; }
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+};
@@ -0,0 +1,84 @@
+//  asyncBench.cpp
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+// Benchmark of the weight update strategies for multi-threaded training:
+// Asynchronous (Hogwild!) training with relaxed atomics, striped row locks and one coarse mutex,
+// next to the synchronous data-parallel training, for 1, 2, 4, ... up to N threads.
+// Reports samples / sec and the test accuracy after training for every combination.
+// Only Sync and Mutex synchronize the reads of the weights: Atomic and RowLocks only protect the
+// updates, their forward and backward passes read the weights while other threads write them.
+//
+// Usage:   asyncBench [mnistPath] [maxThreads] [batchSize]
+// CLANG / GCC compiler flags:		-std=c++14 -O2 -pthread -I..
+
+#include "NeuralNetVec/NeuralNetVec.h"
+
+using namespace std;
+using namespace chrono;
+
+// Percentage of test digits where the strongest output neuron is the label
+double Accuracy(NeuralNetVec& net, const MNIST& mnist) {
+    return net.Evaluate(mnist.testData).accuracy;
+}
+
+int main(int argc, char* argv[]) {
+    const string path = (argc > 1) ? argv[1] : PATH_IN;
+    const long maxThreads = (argc > 2) ? atol(argv[2]) : max<long>(1, thread::hardware_concurrency());
+    const long batchSize = (argc > 3) ? atol(argv[3]) : 1;
+    
+    MNIST mnist(path);
+    
+    cout << "(Atomic / RowLocks: unsynchronized weight reads, Mutex: reads under a shared lock)" <<endl;
+    cout << "Mode\t\tThreads\tSamples/sec\tAccuracy" <<endl;
+    const string modes[] = { "Sync", AsyncUpdateName(AsyncUpdate::Atomic), AsyncUpdateName(AsyncUpdate::RowLocks), AsyncUpdateName(AsyncUpdate::Mutex) };
+    for (long m = 0; m < 4; m++) {
+        for (long threads = 1; threads <= maxThreads; threads = (threads * 2 > maxThreads && threads < maxThreads) ? maxThreads : threads * 2) {
+            // Same start weights for every run
+            srand(1);
+            // The synchronous net splits every batch into GRADIENT_SHARDS shards that the threads share
+            // (at least one sample per thread, so a larger thread count also trains with a larger batch)
+            const long syncBatch = max(batchSize, threads);
+            NeuralNetVec net = NeuralNetVec(LAYER_NEURON_TOPOLOGY, ETA, (m == 0) ? syncBatch : batchSize, (m == 0) ? threads : 1);
+            
+            const auto t1 = steady_clock::now();
+            if (m == 0) { net.Train(TRAINING_ITER, mnist.trainingData); }
+            else { net.TrainAsync(TRAINING_ITER, mnist.trainingData, threads, (AsyncUpdate)(m - 1)); }
+            const auto t2 = steady_clock::now();
+            
+            const double seconds = duration<double>(t2 - t1).count();
+            const double samples = (double)TRAINING_ITER * mnist.trainingData.size();
+            cout << modes[m] << "\t" <<(modes[m].size() < 8 ? "\t" : "") << threads << "\t" << (long)(samples / seconds)
+                 << "\t\t" << Accuracy(net, mnist) << "%" <<endl;
+        }
+    }
+    
+    return 0;
+}
@@ -0,0 +1,88 @@
+//  fixedBench.cpp
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+// Benchmark of the compile-time fixed topology net (NeuralNetFixed) against the dynamic
+// NeuralNetVec with the same settings (batch size 1, one thread, same start weights, the training
+// digits in the order of the set): training samples / sec, inference latency per digit and the test
+// accuracy of both. The dynamic net runs without shuffling and without the sparse input layer,
+// which NeuralNetFixed does not have, and with sigmoid activations (NeuralNetFixed ignores HIDDEN_ACTIVATION / OUTPUT_ACTIVATION).
+//
+// Usage:   fixedBench [mnistPath] [iterations]
+// CLANG / GCC compiler flags:		-std=c++14 -O3 -march=native -pthread -I..
+// (The fixed net is vectorized by the compiler, so it only uses the instruction sets enabled at compile time,
+// NeuralNetVec picks its SIMD kernels at runtime)
+
+#include "NeuralNetVec/NeuralNetVec.h"
+#include "NeuralNetVec/NeuralNetFixed.h"
+
+using namespace std;
+using namespace chrono;
+
+typedef NeuralNetFixed<NET_SCALAR, LAYER_NEURONS> NetFixed;
+
+// The inference results are summed up into this sink, so the compiler can not drop the inference loop
+volatile NET_SCALAR inferenceSink = 0;
+
+template<typename Net>
+void Benchmark(const string& name, Net& net, const MNIST& mnist, long iterations) {
+    const auto t1 = steady_clock::now();
+    net.Train(iterations, mnist.trainingData);
+    const auto t2 = steady_clock::now();
+    NET_SCALAR check = 0;
+    for (const auto t : mnist.testData) { check += net.FeedForward(t)[0]; }
+    inferenceSink = check;
+    const auto t3 = steady_clock::now();
+    
+    const double samples = (double)iterations * mnist.trainingData.size();
+    const double latency = duration<double, micro>(t3 - t2).count() / mnist.testData.size();
+    cout << name << "\t" << (long)(samples / duration<double>(t2 - t1).count()) << "\t\t" << latency
+         << "\t\t" << net.Evaluate(mnist.testData).accuracy << "%" <<endl;
+}
+
+int main(int argc, char* argv[]) {
+    const string path = (argc > 1) ? argv[1] : PATH_IN;
+    const long iterations = (argc > 2) ? atol(argv[2]) : TRAINING_ITER;
+    
+    MNIST mnist(path);
+    
+    cout << "Net\tSamples/sec\tLatency (us)\tAccuracy" <<endl;
+    srand(1);
+    NeuralNetVec dynamicNet(LAYER_NEURON_TOPOLOGY, ETA, 1, 1);
+    dynamicNet.SetShuffle(false);
+    dynamicNet.SetSparseInput(false);
+    dynamicNet.SetActivations(Activation::Sigmoid, Activation::Sigmoid);
+    Benchmark("Dynamic", dynamicNet, mnist, iterations);
+    srand(1);
+    unique_ptr<NetFixed> fixedNet(new NetFixed(ETA));
+    Benchmark("Fixed", *fixedNet, mnist, iterations);
+    
+    return 0;
+}
@@ -0,0 +1,198 @@
+//  netBench.cpp
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+// Kernel and end-to-end benchmark suite: the NetMath.h kernels at several layer sizes and batch sizes
+// (GFLOP/s and GB/s of the minimal memory traffic), the activation and optimizer kernels, loading MNIST,
+// FeedForward / BackPropagate steps, full training epochs, Evaluate and test() of both nets.
+// Prints a table and writes all the samples as JSON, to track the performance across releases.
+//
+// Usage:   netBench [mnistPath] [jsonPath] [epochRepetitions]    (epochRepetitions 0 = skip the training epochs)
+// CLANG / GCC compiler flags:		-std=c++14 -O2 -pthread -I..
+
+#include "NeuralNetOOP/NeuralNetOOP.h"
+#include "NeuralNetVec/NeuralNetVec.h"
+#include "NetBench.h"
+
+using namespace std;
+
+#define BENCH_EPOCH_REPETITIONS     3                           // Default samples of the full training epochs
+#define BENCH_STEP_BATCH            32                          // Batch size of the batched kernels / steps
+
+typedef NET_SCALAR Real;
+typedef vector<Real> Values;
+
+// Layer shapes of the kernels (rows = neurons of the next layer, columns = neurons of the layer)
+static const long KernelShapes[][2] = { {120, 784}, {10, 120}, {256, 256}, {1024, 1024} };
+
+
+Values RandomValues(long n) {
+    Values values(n);
+    for (long i = 0; i < n; i++) { values[i] = (Real)random_0_1; }
+    return values;
+}
+
+
+void BenchKernels(NetBench& bench) {
+    const double S = sizeof(Real);
+    for (const auto& shape : KernelShapes) {
+        const long rows = shape[0], columns = shape[1];
+        const Values weights = RandomValues(rows * columns);
+        const Values bias = RandomValues(rows);
+        for (long batch : { 1L, (long)BENCH_STEP_BATCH }) {
+            const Values input = RandomValues(batch * columns);
+            const Values deltas = RandomValues(batch * rows);
+            Values result(batch * max(rows, columns));
+            Values weightDelta(rows * columns), update = weights;
+            const double flops = 2.0 * rows * columns * batch;
+            const double matrixBytes = S * (rows * columns + batch * (rows + columns));
+            
+            bench.Measure("kernel", "CalculateDot", rows, columns, batch, flops, matrixBytes, [&]() {
+                CalculateDot(weights.data(), input.data(), result.data(), rows, columns, batch);
+            });
+            bench.Measure("kernel", "CalculateDotTransposed", rows, columns, batch, flops, matrixBytes, [&]() {
+                CalculateDotTransposed(weights.data(), deltas.data(), result.data(), rows, columns, batch);
+            });
+            bench.Measure("kernel", "CalculateDotSigmoid", rows, columns, batch, flops, matrixBytes, [&]() {
+                CalculateDotActivation(result, weights.data(), input, bias.data(), rows, columns, batch, Activation::Sigmoid);
+            });
+            bench.Measure("kernel", "CalculateWeightDeltaSum", rows, columns, batch, flops, matrixBytes, [&]() {
+                CalculateWeightDeltaSum(weightDelta, input, deltas, rows, columns, batch);
+            });
+            bench.Measure("kernel", "UpdateWeightFused", rows, columns, batch, flops, matrixBytes + S * rows * columns, [&]() {
+                UpdateWeightFused(update, input, deltas, rows, columns, batch, 1e-9);
+            });
+        }
+        
+        // Element wise kernels on one weight matrix / one batch of layer outputs
+        const long n = rows * columns;
+        const Values gradient = RandomValues(n);
+        Values w = weights, m(n, 0), v(n, 0);
+        bench.Measure("kernel", "MomentumStep", rows, columns, 1, 4.0 * n, 5 * S * n, [&]() {
+            Simd<Real>().MomentumStep(gradient.data(), 1, w.data(), m.data(), n, (Real)1e-9, (Real)ALPHA);
+        });
+        bench.Measure("kernel", "AdamStep", rows, columns, 1, 12.0 * n, 7 * S * n, [&]() {
+            Simd<Real>().AdamStep(gradient.data(), 1, w.data(), m.data(), v.data(), n, (Real)1e-9, (Real)ADAM_BETA1, (Real)ADAM_BETA2, (Real)ADAM_EPSILON);
+        });
+        const Values sums = RandomValues(BENCH_STEP_BATCH * rows);
+        Values outputs = sums;
+        for (Activation activation : { Activation::Sigmoid, Activation::Tanh, Activation::ReLU, Activation::Softmax }) {
+            bench.Measure("kernel", string("Activate ") + ActivationName(activation), rows, 1, BENCH_STEP_BATCH, 0, 2 * S * outputs.size(), [&]() {
+                copy(sums.begin(), sums.end(), outputs.begin());
+                Activate(activation, outputs.data(), rows, BENCH_STEP_BATCH);
+            });
+        }
+    }
+}
+
+
+void BenchVec(NetBench& bench, const MNIST& mnist, const string& resultsPath, long epochRepetitions) {
+    const Topology topology = LAYER_NEURON_TOPOLOGY;
+    srand(1);
+    NeuralNetVec net(topology, ETA, BENCH_STEP_BATCH, THREAD_COUNT);
+    long next = 0;
+    
+    bench.Measure("vec", "FeedForward digit", 0, 0, 1, 0, 0, [&]() {
+        net.FeedForward(mnist.testData[next++ % mnist.testData.size()]);
+    });
+    for (long batch : { 1L, (long)BENCH_STEP_BATCH }) {
+        Values input(batch * topology.front()), expected(batch * topology.back());
+        for (long b = 0; b < batch; b++) {
+            mnist.trainingData[b].normalizedPixels(input.data() + b * topology.front());
+            mnist.trainingData[b].expectedOutput(expected.data() + b * topology.back());
+        }
+        bench.Measure("vec", "FeedForward b" + to_string(batch), 0, 0, batch, 0, 0, [&]() { net.FeedForward(input, batch); });
+        bench.MeasureEach("vec", "BackPropagate b" + to_string(batch), [&]() { net.FeedForward(input, batch); },
+                          [&]() { net.BackPropagate(expected, batch); });
+    }
+    bench.MeasureEach("vec", "Evaluate", []() {}, [&]() { net.Evaluate(mnist.testData); }, 5, 1);
+    bench.MeasureEach("vec", "test", []() {}, [&]() { net.test(const_cast<MNIST&>(mnist), resultsPath + "VEC.txt"); }, 5, 1);
+    if (epochRepetitions > 0) {
+        NeuralNetVec trainNet(topology, ETA, BATCH_SIZE, THREAD_COUNT);
+        bench.MeasureEach("vec", "epoch", []() {}, [&]() { trainNet.Train(1, mnist.trainingData); }, epochRepetitions, 0);
+    }
+}
+
+
+void BenchOOP(NetBench& bench, const MNIST& mnist, const string& resultsPath, long epochRepetitions) {
+    const Topology topology = LAYER_NEURON_TOPOLOGY;
+    srand(1);
+    NeuralNetOOP net(topology);
+    vector<double> input(topology.front()), expected(topology.back());
+    mnist.trainingData[0].normalizedPixels(input.data());
+    mnist.trainingData[0].expectedOutput(expected.data());
+    
+    bench.Measure("oop", "feedForward", 0, 0, 1, 0, 0, [&]() { net.feedForward(input); });
+    bench.MeasureEach("oop", "backPropagate", [&]() { net.feedForward(input); }, [&]() { net.backPropagate(expected); });
+    bench.MeasureEach("oop", "evaluate", []() {}, [&]() { net.evaluate(mnist.testData); }, 3, 1);
+    bench.MeasureEach("oop", "test", []() {}, [&]() { net.test(const_cast<MNIST&>(mnist), resultsPath + "OOP.txt"); }, 3, 1);
+    if (epochRepetitions > 0) {
+        // ("train" runs TRAINING_ITER epochs)
+        bench.MeasureEach("oop", "epoch", []() {}, [&]() { net.train(mnist); }, epochRepetitions, 0);
+    }
+}
+
+
+// e.g. "784-120-10"
+string TopologyName(const Topology& topology) {
+    string name;
+    for (ulong neurons : topology) { name += (name.empty() ? "" : "-") + to_string(neurons); }
+    return name;
+}
+
+
+int main(int argc, char* argv[]) {
+    const string path = (argc > 1) ? argv[1] : PATH_IN;
+    const string jsonPath = (argc > 2) ? argv[2] : "netBench.json";
+    const long epochRepetitions = (argc > 3) ? atol(argv[3]) : BENCH_EPOCH_REPETITIONS;
+    const string resultsPath = jsonPath + ".";
+    
+    NetBench bench(&cout);
+    
+    // Loading maps the files, checks the headers and copies all the digits into the sets (see MNISTset)
+    bench.MeasureEach("data", "MNIST load", []() {}, [&]() { MNIST load(path); }, 5, 1);
+    MNIST mnist(path);
+    if (!mnist.trainingData.size() || !mnist.testData.size()) { return 1; }
+    
+    BenchKernels(bench);
+    BenchVec(bench, mnist, resultsPath, epochRepetitions);
+    BenchOOP(bench, mnist, resultsPath, epochRepetitions);
+    
+    const vector<pair<string, string>> info = {
+        { "simd", Simd<Real>().name }, { "scalar", (sizeof(Real) == sizeof(float)) ? "float" : "double" },
+        { "topology", TopologyName(LAYER_NEURON_TOPOLOGY) },
+        { "batchSize", to_string(BATCH_SIZE) }, { "threads", to_string(THREAD_COUNT) },
+        { "fastExp", ACTIVATION_FAST_EXP ? "true" : "false" },
+#ifdef __VERSION__
+        { "compiler", __VERSION__ },
+#endif
+    };
+    return bench.WriteJson(jsonPath, info) ? 0 : 1;
+}
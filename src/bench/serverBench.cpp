@@ -0,0 +1,135 @@
+//  serverBench.cpp
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+// Load generator of the inference server (see NetServer.h): 1, 2, 4, ... up to "maxConnections" clients
+// send the test digits as fast as they get the replies (closed loop, one image in flight per client).
+// Reports the client side latency (p50 / p99), images / sec, the accuracy of the replies and the mean
+// micro-batch size of the server. Runs the server in the same process on a trained (or imported) net,
+// or tests a running server (e.g. "server model.nn tcp:5555") with the model "external".
+//
+// Usage:   serverBench [mnistPath] [address] [maxConnections] [requestsPerClient] [modelPath | external]
+// CLANG / GCC compiler flags:		-std=c++14 -O2 -pthread -I..
+
+#include "NeuralNetVec/NetServer.h"
+
+using namespace std;
+using namespace chrono;
+
+#define BENCH_ADDRESS               "unix:/tmp/netServer.sock"
+#define BENCH_REQUESTS              2000                        // Images per client and load step
+
+struct LoadResult {
+    vector<double> latencies;               // Microseconds
+    ulong correct, failed;
+};
+
+// "connections" clients, each sends "requests" test digits (starting at a different digit)
+LoadResult Load(const string& address, const MNISTset& data, long connections, long requests) {
+    vector<LoadResult> results(connections);
+    vector<thread> clients;
+    for (long c = 0; c < connections; c++) {
+        clients.push_back(thread([&, c]() {
+            LoadResult& result = results[c];
+            result.correct = result.failed = 0;
+            NetServerClient client;
+            if (!client.Connect(address)) {
+                result.failed = requests;
+                return;
+            }
+            NetServerReply reply;
+            for (long r = 0; r < requests; r++) {
+                const MNISTchar digit = data[(c * 7919 + r) % data.size()];
+                const auto t1 = steady_clock::now();
+                if (!client.Classify(digit.pixelData.data, digit.pixelData.size, reply)) {
+                    result.failed += requests - r;
+                    return;
+                }
+                result.latencies.push_back(duration<double, micro>(steady_clock::now() - t1).count());
+                if ((int)reply.label == digit.label) { result.correct++; }
+            }
+        }));
+    }
+    for (thread& t : clients) { t.join(); }
+    LoadResult total = { {}, 0, 0 };
+    for (const LoadResult& r : results) {
+        total.latencies.insert(total.latencies.end(), r.latencies.begin(), r.latencies.end());
+        total.correct += r.correct;
+        total.failed += r.failed;
+    }
+    sort(total.latencies.begin(), total.latencies.end());
+    return total;
+}
+
+double Percentile(const vector<double>& sorted, double p) {
+    return sorted.empty() ? 0.0 : sorted[(ulong)(p * (sorted.size() - 1) + 0.5)];
+}
+
+int main(int argc, char* argv[]) {
+    const string path = (argc > 1) ? argv[1] : PATH_IN;
+    const string address = (argc > 2) ? argv[2] : BENCH_ADDRESS;
+    const long maxConnections = (argc > 3) ? atol(argv[3]) : 16;
+    const long requests = (argc > 4) ? atol(argv[4]) : BENCH_REQUESTS;
+    const string modelPath = (argc > 5) ? argv[5] : "";
+    
+    MNIST mnist(path);
+    
+    // The net of the in-process server: imported or trained for one iteration
+    unique_ptr<NeuralNetVec> net;
+    unique_ptr<NetServer<NET_SCALAR>> server;
+    if (modelPath != "external") {
+        if (!modelPath.empty()) { net = NeuralNetVec::Import(modelPath); }
+        else {
+            net.reset(new NeuralNetVec(LAYER_NEURON_TOPOLOGY, ETA, BATCH_SIZE, THREAD_COUNT));
+            net->Train(1, mnist.trainingData);
+        }
+        if (!net) { return 1; }
+        server.reset(new NetServer<NET_SCALAR>(*net));
+        if (!server->Start(address)) { return 1; }
+    }
+    
+    cout << "Clients\tImages/sec\tp50 (us)\tp99 (us)\tAccuracy\tBatch" <<endl;
+    for (long connections = 1; connections <= maxConnections; connections = (connections * 2 > maxConnections && connections < maxConnections) ? maxConnections : connections * 2) {
+        if (server) { server->ResetStats(); }
+        const auto t1 = steady_clock::now();
+        const LoadResult result = Load(address, mnist.testData, connections, requests);
+        const double seconds = duration<double>(steady_clock::now() - t1).count();
+        if (result.failed) { cout << "ERROR: " <<result.failed <<" requests failed" <<endl; }
+        cout << connections << "\t" << (long)(result.latencies.size() / seconds) << "\t\t" << (long)Percentile(result.latencies, 0.5)
+             << "\t\t" << (long)Percentile(result.latencies, 0.99) << "\t\t"
+             << (result.latencies.empty() ? 0.0 : 100.0 * result.correct / result.latencies.size()) << "%\t\t";
+        if (server) { cout << server->Stats().meanBatch; }
+        else { cout << "-"; }
+        cout << endl;
+    }
+    
+    if (server) { server->Stop(); }
+    return 0;
+}
@@ -0,0 +1,62 @@
+//  server.cpp
+/*************************************************************************************
+ *  Neural Network to process handwritten digits form the MNIST dataset              *
+ *-----------------------------------------------------------------------------------*
+ *  Copyright (c) 2016, Peter Baumann                                                *
+ *  All rights reserved.                                                             *
+ *                                                                                   *
+ *  Redistribution and use in source and binary forms, with or without               *
+ *  modification, are permitted provided that the following conditions are met:      *
+ *    1. Redistributions of source code must retain the above copyright              *
+ *       notice, this list of conditions and the following disclaimer.               *
+ *    2. Redistributions in binary form must reproduce the above copyright           *
+ *       notice, this list of conditions and the following disclaimer in the         *
+ *       documentation and/or other materials provided with the distribution.        *
+ *    3. Neither the name of the organization nor the                                *
+ *       names of its contributors may be used to endorse or promote products        *
+ *       derived from this software without specific prior written permission.       *
+ *                                                                                   *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND  *
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED    *
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE           *
+ *  DISCLAIMED. IN NO EVENT SHALL PETER BAUMANN BE LIABLE FOR ANY                    *
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES       *
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;     *
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND      *
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT       *
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS    *
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.                     *
+ *                                                                                   *
+ *************************************************************************************/
+
+// Inference server of an exported NeuralNetVec model (see NetServer.h), serves until Enter is pressed
+// and prints the latency / throughput statistics. Load test: bench/serverBench.cpp with the model "external"
+//
+// Usage:   server modelPath [address] [maxBatch] [maxWait] [workers]      (address: unix:/path or tcp:port)
+// CLANG / GCC compiler flags:		-std=c++14 -O2 -pthread
+
+#include "NeuralNetVec/NetServer.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        cout << "Usage: server modelPath [address] [maxBatch] [maxWait] [workers]" <<endl;
+        return 1;
+    }
+    const string address = (argc > 2) ? argv[2] : "unix:/tmp/netServer.sock";
+    unique_ptr<NeuralNetVec> net = NeuralNetVec::Import(argv[1]);
+    if (!net) { return 1; }
+    NetServer<NET_SCALAR> server(*net, (argc > 3) ? atol(argv[3]) : SERVER_MAX_BATCH, (argc > 4) ? atol(argv[4]) : SERVER_MAX_WAIT,
+                                 (argc > 5) ? atol(argv[5]) : SERVER_WORKERS);
+    if (!server.Start(address)) { return 1; }
+    cout << "Serving " <<argv[1] <<" on " <<address <<" (press Enter to stop)" <<endl;
+    cin.get();
+    server.Stop();
+    
+    const NetServerStats stats = server.Stats();
+    cout << "Requests:\t" <<stats.requests <<" in " <<stats.batches <<" batches (" <<stats.meanBatch <<" images per batch)" <<endl;
+    cout << "Throughput:\t" <<stats.requestsPerSec <<" images/sec" <<endl;
+    cout << "Latency:\tp50 " <<stats.p50 <<" us, p99 " <<stats.p99 <<" us, max " <<stats.max <<" us" <<endl;
+    return 0;
+}